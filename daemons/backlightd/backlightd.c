@@ -16,6 +16,8 @@
 #include <zmq.h>
 #include <syslog.h>
 
+#include "../bootmark.h"
+
 /**
  * Type definitions
  */
@@ -132,6 +134,7 @@ int main(int argc, char **argv)
     openlog("backlightd", LOG_PID, LOG_DAEMON);
 
     syslog(LOG_INFO, "Starting backlight daemon.");
+    bootmark("backlightd", "start", false);
 
     /* Create ZeroMQ context */
     zmq_context = zmq_ctx_new();
@@ -171,6 +174,7 @@ int main(int argc, char **argv)
     clear_opts(&opts);
 
     syslog(LOG_NOTICE, "Backlight daemon started.");
+    bootmark("backlightd", "ready", true);
 
     while (opts.running) {
         err = zmq_recv(zmq_sock, buf, 128, 0);
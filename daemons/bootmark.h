@@ -0,0 +1,58 @@
+/**
+ * Boot progress marks for the CARACAS project.
+ *
+ * Each program logs a mark when it reaches a milestone during startup,
+ * stamped with the monotonic clock. The monotonic clock starts when the
+ * kernel boots, which happens when the ignition is switched on, so marks
+ * from all programs share the same time base. utils/bootpath.py reads the
+ * marks back from the log and reconstructs the boot critical path.
+ *
+ * The mark that makes a program ready also notifies systemd, so that units
+ * of Type=notify are considered started at that point.
+ *
+ * Requires libsystemd.
+ */
+
+#ifndef _BOOTMARK_H_
+#define _BOOTMARK_H_
+
+#include <stdbool.h>
+#include <syslog.h>
+#include <time.h>
+#include <systemd/sd-daemon.h>
+
+/**
+ * Log lines look like "BOOTMARK <program> <stage> <microseconds>".
+ */
+#define BOOTMARK_PREFIX "BOOTMARK"
+
+/**
+ * Returns the monotonic clock reading in microseconds.
+ */
+static inline unsigned long long bootmark_usec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/**
+ * Log a boot milestone. If `ready` is set, also tell systemd that startup
+ * has finished.
+ */
+static inline void bootmark(const char * program, const char * stage, bool ready)
+{
+    unsigned long long usec;
+
+    usec = bootmark_usec();
+    syslog(LOG_INFO, BOOTMARK_PREFIX " %s %s %llu", program, stage, usec);
+
+    if (ready) {
+        sd_notifyf(0, "READY=1\nSTATUS=%s %s at %llu us", program, stage, usec);
+    } else {
+        sd_notifyf(0, "STATUS=%s %s at %llu us", program, stage, usec);
+    }
+}
+
+#endif /* _BOOTMARK_H_ */
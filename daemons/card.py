@@ -8,6 +8,8 @@ import syslog
 import subprocess32
 import datetime
 import time
+import ctypes
+import socket
 
 
 # Touch this file to prevent shutdown by Card in any circumstance
@@ -34,6 +36,48 @@ TICK = 100
 # Subprocess timeout in seconds
 SUBPROCESS_TIMEOUT = 3
 
+# clock_gettime() clock ID, see daemons/bootmark.h
+CLOCK_MONOTONIC = 1
+
+
+class timespec(ctypes.Structure):
+    _fields_ = [('tv_sec', ctypes.c_long), ('tv_nsec', ctypes.c_long)]
+
+
+librt = ctypes.CDLL('librt.so.1', use_errno=True)
+
+
+def sd_notify(state):
+    """
+    Send a state string to systemd, if started as a Type=notify service
+    """
+    path = os.environ.get('NOTIFY_SOCKET')
+    if not path:
+        return
+    if path.startswith('@'):
+        path = '\0' + path[1:]
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_DGRAM)
+    try:
+        sock.sendto(state, path)
+    except socket.error:
+        pass
+    finally:
+        sock.close()
+
+
+def bootmark(stage, ready=False):
+    """
+    Log a boot milestone in the same format as daemons/bootmark.h
+    """
+    ts = timespec()
+    librt.clock_gettime(CLOCK_MONOTONIC, ctypes.byref(ts))
+    usec = ts.tv_sec * 1000000 + ts.tv_nsec / 1000
+    syslog.syslog("BOOTMARK card %s %d" % (stage, usec))
+    status = "STATUS=card %s at %d us" % (stage, usec)
+    if ready:
+        status = "READY=1\n" + status
+    sd_notify(status)
+
 
 def repeatable(func):
     """
@@ -128,6 +172,7 @@ class Dispatcher(object):
     def boot(self):
         syslog.syslog("System booted, turning on music.")
         self.publisher.send_string('MPD UNPAUSE')
+        bootmark('music')
 
     def is_keepalive(self):
         return os.path.exists(SHUTDOWN_PREVENT_FILE)
@@ -343,6 +388,7 @@ if __name__ == '__main__':
     args = parser.parse_args()
 
     syslog.openlog('card', syslog.LOG_PID, syslog.LOG_DAEMON)
+    bootmark('start')
 
     if not args.debug:
         syslog.setlogmask(syslog.LOG_UPTO(syslog.LOG_INFO))
@@ -354,6 +400,7 @@ if __name__ == '__main__':
 
     card = Card(dispatcher)
     card.setup_zeromq()
+    bootmark('ready', True)
 
     try:
         card.run()
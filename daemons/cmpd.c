@@ -1,12 +1,18 @@
+#define _GNU_SOURCE
 #include <mpd/client.h>
 #include <zmq.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <locale.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <syslog.h>
 
-#define CMD_NUM_ERROR -1
-#define CMD_NUM_NONE 0
+#include "bootmark.h"
+
 #define CMD_NUM_VOLUME_STEP 1
 #define CMD_NUM_NEXT 2
 #define CMD_NUM_PREV 3
@@ -17,48 +23,216 @@
 #define CMD_NUM_PREV_ARTIST 8
 #define CMD_NUM_NEXT_ALBUM 9
 #define CMD_NUM_PREV_ALBUM 10
+#define CMD_NUM_SEEK 11
+#define CMD_NUM_SHUFFLE 12
+#define CMD_NUM_PLAY_ID 13
+
+/* All messages for cmpd start with this, followed by a command name and
+ * its parameters, separated by single spaces */
+#define MSG_PREFIX "MPD "
+
+/* Longest command name */
+#define CMD_NAME_MAX 32
+
+/* Longest command list whose command names are kept for error reports */
+#define BATCH_MAX 16
+
+/* Returned when a command list could not be queued completely. Ending the
+ * list would run the commands queued so far, so the connection is dropped
+ * instead. */
+#define BATCH_UNFINISHED -2
+
+/* Commands waiting to run; when full, the oldest one is dropped */
+#define QUEUE_MAX 16
+
+/* Delay before reconnecting to mpd, doubled after each failed attempt */
+#define RECONNECT_MIN_MS 250
+#define RECONNECT_MAX_MS 8000
+
+#define IDLE_EVENTS (MPD_IDLE_DATABASE | MPD_IDLE_MIXER)
+
+/* Initial sizes of the tag list buffers, which grow as needed */
+#define TAGS_INITIAL_COUNT 64
+#define TAGS_INITIAL_BYTES 4096
+
+/* Locale used to sort artists and albums, so that Æ, Ø and Å come after Z */
+#define COLLATE_LOCALE "nb_NO.UTF-8"
+
+/* A list of mpd commands sent in a single round trip */
+struct batch {
+    struct mpd_connection * connection;
+    const char * names[BATCH_MAX];
+    int count;
+};
+
+/* A tag value and its collation key, which compares with strcmp. Both are
+ * offsets into the string arena of a tag list. */
+struct tag {
+    size_t name;
+    size_t key;
+};
+
+/* Sorted tag values. All strings live in one arena, and both buffers are
+ * kept and reused when the list is filled again. */
+struct tag_list {
+    bool valid;
+    char * strings;
+    size_t strings_size;
+    size_t strings_alloc;
+    struct tag * tags;
+    size_t count;
+    size_t alloc;
+};
+
+/* Sorted artists, and the sorted albums of each artist, indexed like the
+ * artists. Album tables are filled when first needed. All tables stay valid
+ * until the notification connection reports a database change. */
+struct tag_cache {
+    struct tag_list artists;
+    struct tag_list * albums;
+    size_t albums_count;
+    struct tag_list unknown_artist_albums;
+};
+
+/* A command name, the range of its integer parameter, if it has one, and
+ * how long after it was received it may still run */
+struct command_def {
+    const char * name;
+    int num;
+    bool has_param;
+    long min;
+    long max;
+    int timeout_ms;
+};
+
+/* A parsed message, with the monotonic time after which it is dropped */
+struct command {
+    int num;
+    int param;
+    unsigned long long deadline;
+};
+
+/* Ring buffer of commands waiting for mpd */
+struct command_queue {
+    struct command items[QUEUE_MAX];
+    int head;
+    int count;
+};
+
+/* Known commands, sorted by name in strcmp order so that they can be
+ * looked up with bsearch. Keep the order when adding commands; it is
+ * checked at startup.
+ *
+ * Commands that wait for mpd are dropped once their timeout has passed, as
+ * a button pressed several seconds ago should not take effect any more.
+ * UNPAUSE is sent at boot, possibly before mpd is up, so it waits longer. */
+static const struct command_def commands[] = {
+    { "NEXT",          CMD_NUM_NEXT,        false, 0, 0,             3000 },
+    { "NEXT ALBUM",    CMD_NUM_NEXT_ALBUM,  false, 0, 0,             3000 },
+    { "NEXT ARTIST",   CMD_NUM_NEXT_ARTIST, false, 0, 0,             3000 },
+    { "PAUSE",         CMD_NUM_PAUSE,       false, 0, 0,             5000 },
+    { "PLAY ID",       CMD_NUM_PLAY_ID,     true,  0, INT_MAX,       5000 },
+    { "PLAY OR PAUSE", CMD_NUM_PLAY_PAUSE,  false, 0, 0,             3000 },
+    { "PREV",          CMD_NUM_PREV,        false, 0, 0,             3000 },
+    { "PREV ALBUM",    CMD_NUM_PREV_ALBUM,  false, 0, 0,             3000 },
+    { "PREV ARTIST",   CMD_NUM_PREV_ARTIST, false, 0, 0,             3000 },
+    { "SEEK",          CMD_NUM_SEEK,        true,  -86400, 86400,    2000 },
+    { "SHUFFLE",       CMD_NUM_SHUFFLE,     false, 0, 0,             5000 },
+    { "UNPAUSE",       CMD_NUM_UNPAUSE,     false, 0, 0,             30000 },
+    { "VOLUME STEP",   CMD_NUM_VOLUME_STEP, true,  -100, 100,        1000 },
+};
+
+#define COMMANDS_COUNT (sizeof(commands) / sizeof(commands[0]))
+
+static locale_t collation;
+static struct tag_cache cache;
+
+/* Connection kept in IDLE mode, reporting database and mixer changes */
+static struct mpd_connection * idle_connection;
+
+/* Mixer volume as last reported by mpd or set by us; -1 if unknown */
+static int mixer_volume = -1;
+
+/* Monotonic clock in milliseconds */
+unsigned long long now_ms()
+{
+    return bootmark_usec() / 1000;
+}
+
+/* Check that the command table is sorted, and that its names fit */
+int check_commands()
+{
+    size_t i;
+
+    for (i = 0; i < COMMANDS_COUNT; i++) {
+        if (strlen(commands[i].name) >= CMD_NAME_MAX ||
+            (i > 0 && strcmp(commands[i - 1].name, commands[i].name) >= 0)) {
+            syslog(LOG_EMERG, "Command table is not sorted at '%s'", commands[i].name);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int command_def_comp(const void * key, const void * def)
+{
+    return strcmp((const char *) key, ((const struct command_def *) def)->name);
+}
+
+/* Parse a message. The command name is everything up to the first
+ * parameter, i.e. the first word starting with a digit or a sign, and must
+ * match a command exactly. Returns 0, or -1 if the message is invalid. */
+int parse_command(const char * msg, struct command * command)
+{
+    const struct command_def * def;
+    const char * end;
+    char name[CMD_NAME_MAX];
+    char * param_end;
+    long value;
+
+    if (strncmp(msg, MSG_PREFIX, strlen(MSG_PREFIX))) {
+        return -1;
+    }
+    msg += strlen(MSG_PREFIX);
+
+    for (end = msg; *end; end++) {
+        if (end[0] == ' ' && (isdigit((unsigned char) end[1]) || end[1] == '-' || end[1] == '+')) {
+            break;
+        }
+    }
+
+    if ((size_t)(end - msg) >= sizeof(name)) {
+        return -1;
+    }
+    memcpy(name, msg, end - msg);
+    name[end - msg] = '\0';
+
+    def = bsearch(name, commands, COMMANDS_COUNT, sizeof(struct command_def), command_def_comp);
+    if (!def) {
+        return -1;
+    }
 
-#define CMD_VOLUME_STEP "VOLUME STEP"
-#define CMD_NEXT "NEXT"
-#define CMD_PREV "PREV"
-#define CMD_PLAY_PAUSE "PLAY OR PAUSE"
-#define CMD_PAUSE "PAUSE"
-#define CMD_UNPAUSE "UNPAUSE"
-#define CMD_NEXT_ARTIST "NEXT ARTIST"
-#define CMD_PREV_ARTIST "PREV ARTIST"
-#define CMD_NEXT_ALBUM "NEXT ALBUM"
-#define CMD_PREV_ALBUM "PREV ALBUM"
-
-#define PARAM_POS(X, Y)  (char *)X + strlen(Y) + 1
-
-int cmd_from_msg(char *msg, void **params)
-{
-    *params = NULL;
-
-    if (!strncmp(msg, CMD_VOLUME_STEP, strlen(CMD_VOLUME_STEP))) {
-        *params = PARAM_POS(msg, CMD_VOLUME_STEP);
-        return CMD_NUM_VOLUME_STEP;
-    } else if (!strncmp(msg, CMD_NEXT_ARTIST, strlen(CMD_NEXT_ARTIST))) {
-        return CMD_NUM_NEXT_ARTIST;
-    } else if (!strncmp(msg, CMD_PREV_ARTIST, strlen(CMD_PREV_ARTIST))) {
-        return CMD_NUM_PREV_ARTIST;
-    } else if (!strncmp(msg, CMD_NEXT_ALBUM, strlen(CMD_NEXT_ALBUM))) {
-        return CMD_NUM_NEXT_ALBUM;
-    } else if (!strncmp(msg, CMD_PREV_ALBUM, strlen(CMD_PREV_ALBUM))) {
-        return CMD_NUM_PREV_ALBUM;
-    } else if (!strncmp(msg, CMD_NEXT, strlen(CMD_NEXT))) {
-        return CMD_NUM_NEXT;
-    } else if (!strncmp(msg, CMD_PREV, strlen(CMD_PREV))) {
-        return CMD_NUM_PREV;
-    } else if (!strncmp(msg, CMD_PLAY_PAUSE, strlen(CMD_PLAY_PAUSE))) {
-        return CMD_NUM_PLAY_PAUSE;
-    } else if (!strncmp(msg, CMD_PAUSE, strlen(CMD_PAUSE))) {
-        return CMD_NUM_PAUSE;
-    } else if (!strncmp(msg, CMD_UNPAUSE, strlen(CMD_UNPAUSE))) {
-        return CMD_NUM_UNPAUSE;
-    }
-
-    return CMD_NUM_ERROR;
+    command->num = def->num;
+    command->param = 0;
+    command->deadline = now_ms() + def->timeout_ms;
+
+    if (!def->has_param) {
+        return *end == '\0' ? 0 : -1;
+    }
+    if (*end == '\0') {
+        return -1;
+    }
+
+    errno = 0;
+    value = strtol(end + 1, &param_end, 10);
+    if (errno || *param_end != '\0' || value < def->min || value > def->max) {
+        return -1;
+    }
+
+    command->param = value;
+
+    return 0;
 }
 
 struct mpd_connection * get_mpd_connection()
@@ -77,185 +251,506 @@ struct mpd_connection * get_mpd_connection()
     err = mpd_connection_get_error(connection);
     if (err != MPD_ERROR_SUCCESS) {
         syslog(LOG_WARNING, "Failed to connect to mpd: %s", mpd_connection_get_error_message(connection));
-    } else {
-        syslog(LOG_INFO, "Connected to mpd server.");
+        mpd_connection_free(connection);
+        return NULL;
     }
 
+    syslog(LOG_INFO, "Connected to mpd server.");
+
     return connection;
 }
 
-int comp(const void * a, const void * b)
+/* Start a command list; commands are then queued with the mpd_send functions */
+int batch_begin(struct batch * batch, struct mpd_connection * connection)
 {
-    const char **ac = (const char **) a;
-    const char **bc = (const char **) b;
-    return strcmp(*ac, *bc);
+    batch->connection = connection;
+    batch->count = 0;
+
+    /* Ask for list_OK after each command, so the failing one can be located */
+    if (!mpd_command_list_begin(connection, true)) {
+        return -1;
+    }
+
+    return 0;
 }
 
-int get_sorted_tags(struct mpd_connection * connection, char ** array, enum mpd_tag_type tag, struct mpd_song * song)
+/* Register a queued command, given the return value of its send function */
+int batch_add(struct batch * batch, const char * name, bool sent)
 {
-    struct mpd_pair * pair;
-    char ** ptr = array;
-    const char * tag_content = NULL;
-    int count;
-    int total = 0;
-
-    if (!mpd_search_db_tags(connection, tag)) {
+    if (!sent) {
+        syslog(LOG_WARNING, "Unable to queue mpd command %d '%s': %s",
+               batch->count + 1, name, mpd_connection_get_error_message(batch->connection));
         return -1;
     }
 
-    if (tag == MPD_TAG_ALBUM && song) {
-        tag_content = mpd_song_get_tag(song, MPD_TAG_ARTIST, 0);
-        if (tag_content && !mpd_search_add_tag_constraint(connection, MPD_OPERATOR_DEFAULT, MPD_TAG_ARTIST, tag_content)) {
-            return -1;
-        }
+    if (batch->count < BATCH_MAX) {
+        batch->names[batch->count] = name;
     }
+    batch->count++;
 
-    if (!mpd_search_commit(connection)) {
+    return 0;
+}
+
+/* Send the command list and read the reply. A failing command is logged and
+ * its error cleared, since running the list again would fail the same way. */
+int batch_run(struct batch * batch)
+{
+    unsigned location;
+    int i;
+
+    if (!mpd_command_list_end(batch->connection)) {
         return -1;
     }
 
-    memset(array, 0, sizeof(array) * sizeof(char *));
+    for (i = 0; i < batch->count; i++) {
+        if (!mpd_response_next(batch->connection)) {
+            break;
+        }
+    }
 
-    while ((pair = mpd_recv_pair_tag(connection, tag)) != NULL) {
-        *ptr = malloc(100);
-        strncpy(*ptr, pair->value, 99);
-        ++ptr;
-        ++total;
-        mpd_return_pair(connection, pair);
+    if (i == batch->count && mpd_response_finish(batch->connection)) {
+        return 0;
     }
 
-    ptr = array;
-    qsort(ptr, total, sizeof(char *), comp);
+    if (mpd_connection_get_error(batch->connection) == MPD_ERROR_SERVER) {
+        location = mpd_connection_get_server_error_location(batch->connection);
+        syslog(LOG_WARNING, "mpd command %u of %d (%s) failed: %s",
+               location + 1, batch->count,
+               location < BATCH_MAX ? batch->names[location] : "?",
+               mpd_connection_get_error_message(batch->connection));
+        mpd_connection_clear_error(batch->connection);
+    }
 
-    return total;
+    return -1;
 }
 
-void free_sorted_tags(char ** array, int total)
+/* Open the collation locale, falling back to byte order */
+void collation_init()
 {
-    while (total-- > 0) {
-        free(*array);
-        array++;
+    collation = newlocale(LC_COLLATE_MASK, COLLATE_LOCALE, (locale_t)0);
+    if (!collation) {
+        syslog(LOG_WARNING, "Collation locale %s is not available, sorting bytewise.", COLLATE_LOCALE);
+        collation = newlocale(LC_COLLATE_MASK, "C", (locale_t)0);
     }
 }
 
-int get_next_in_line(struct mpd_connection * connection, int delta, enum mpd_tag_type tag, char *dest)
+/* Make room for `size` more bytes in the string arena */
+int tag_list_reserve(struct tag_list * list, size_t size)
 {
-    struct mpd_song * song;
-    char * array[4096];
-    char ** ptr = array;
-    char buf[128];
-    char artist[128];
-    const char * tag_content = NULL;
-    int pos = 0;
-    int total;
+    size_t alloc;
+    char * strings;
 
-    song = mpd_run_current_song(connection);
-    if (song) {
-        tag_content = mpd_song_get_tag(song, tag, 0);
-        if (tag_content) {
-            strncpy(buf, tag_content, 127);
-        }
+    if (list->strings_size + size <= list->strings_alloc) {
+        return 0;
     }
 
-    if (!tag_content) {
-        buf[0] = '\0';
+    alloc = list->strings_alloc ? list->strings_alloc : TAGS_INITIAL_BYTES;
+    while (alloc < list->strings_size + size) {
+        alloc *= 2;
     }
 
-    total = get_sorted_tags(connection, array, tag, song);
-
-    if (song) {
-        mpd_song_free(song);
+    strings = realloc(list->strings, alloc);
+    if (!strings) {
+        return -1;
     }
 
-    if (total == -1) {
-        syslog(LOG_WARNING, "Could not retrieve a list of tags from the mpd server!");
+    list->strings = strings;
+    list->strings_alloc = alloc;
+
+    return 0;
+}
+
+/* Write the collation key of a string at the end of the arena, without
+ * adding it. Returns the offset of the key, or -1 when out of memory. */
+long tag_list_put_key(struct tag_list * list, const char * str)
+{
+    size_t size;
+
+    size = strxfrm_l(NULL, str, 0, collation) + 1;
+    if (tag_list_reserve(list, size) == -1) {
         return -1;
     }
+    strxfrm_l(list->strings + list->strings_size, str, size, collation);
 
-    while (*ptr != NULL) {
-        if (!strcmp(buf, *ptr)) {
-            pos += delta;
-            while (pos >= total) {
-                pos -= total;
-            }
-            while (pos < 0) {
-                pos = total + pos;
-            }
-            ptr = array + pos;
-            strncpy(dest, *ptr, 127);
-            break;
+    return list->strings_size;
+}
+
+/* Append a tag value and its collation key */
+int tag_list_add(struct tag_list * list, const char * name)
+{
+    struct tag * tags;
+    size_t alloc;
+    size_t length;
+    long key;
+
+    if (list->count == list->alloc) {
+        alloc = list->alloc ? list->alloc * 2 : TAGS_INITIAL_COUNT;
+        tags = realloc(list->tags, alloc * sizeof(struct tag));
+        if (!tags) {
+            return -1;
         }
-        ++ptr;
-        ++pos;
+        list->tags = tags;
+        list->alloc = alloc;
     }
 
-    free_sorted_tags(array, total);
+    length = strlen(name) + 1;
+    if (tag_list_reserve(list, length) == -1) {
+        return -1;
+    }
+    memcpy(list->strings + list->strings_size, name, length);
+    list->tags[list->count].name = list->strings_size;
+    list->strings_size += length;
 
-    if (*ptr == NULL) {
-        dest[0] = '\0';
+    if ((key = tag_list_put_key(list, name)) == -1) {
+        list->strings_size -= length;
         return -1;
     }
+    list->tags[list->count].key = key;
+    list->strings_size += strlen(list->strings + key) + 1;
+
+    list->count++;
 
     return 0;
 }
 
-/* Jump to the next or previous song group, based on tag */
-int jump_to(struct mpd_connection * connection, enum mpd_tag_type tag, int delta)
+/* Forget all entries, keeping the buffers */
+void tag_list_clear(struct tag_list * list)
 {
-    struct mpd_pair * pair;
-    char buf[128];
+    list->count = 0;
+    list->strings_size = 0;
+}
 
-    if (!get_next_in_line(connection, delta, tag, buf) == -1) {
-        syslog(LOG_WARNING, "Failed to get next tag in line!");
-        return -1;
+const char * tag_list_name(const struct tag_list * list, size_t index)
+{
+    return list->strings + list->tags[index].name;
+}
+
+int comp(const void * a, const void * b, void * arg)
+{
+    const struct tag * ac = (const struct tag *) a;
+    const struct tag * bc = (const struct tag *) b;
+    const char * strings = (const char *) arg;
+    int cmp;
+
+    cmp = strcmp(strings + ac->key, strings + bc->key);
+    if (cmp == 0) {
+        cmp = strcmp(strings + ac->name, strings + bc->name);
     }
+    return cmp;
+}
 
-    if (!mpd_search_add_db_songs(connection, true)) {
-        syslog(LOG_WARNING, "Unable to initialize mpd search!");
+/* Binary search for a tag value. Returns its index, or -1 if not found. */
+long tag_list_find(struct tag_list * list, const char * name)
+{
+    size_t low = 0;
+    size_t high = list->count;
+    size_t mid;
+    long key;
+    int cmp;
+
+    /* The key is computed into the unused end of the arena */
+    if ((key = tag_list_put_key(list, name)) == -1) {
         return -1;
     }
 
-    if (!mpd_search_add_tag_constraint(connection, MPD_OPERATOR_DEFAULT, tag, buf)) {
-        syslog(LOG_WARNING, "Unable to specify mpd search!");
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        cmp = strcmp(list->strings + list->tags[mid].key, list->strings + key);
+        if (cmp == 0) {
+            cmp = strcmp(tag_list_name(list, mid), name);
+        }
+        if (cmp == 0) {
+            return mid;
+        } else if (cmp < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return -1;
+}
+
+/* Fetch tag values and sort them by their collation keys, computed once per value */
+int get_sorted_tags(struct mpd_connection * connection, struct tag_list * list, enum mpd_tag_type tag, const char * artist)
+{
+    struct mpd_pair * pair;
+    int err = 0;
+
+    tag_list_clear(list);
+
+    if (!mpd_search_db_tags(connection, tag)) {
         return -1;
     }
 
-    if (!mpd_run_clear(connection)) {
-        syslog(LOG_WARNING, "Unable to clear queue!");
+    if (artist && !mpd_search_add_tag_constraint(connection, MPD_OPERATOR_DEFAULT, MPD_TAG_ARTIST, artist)) {
         return -1;
     }
 
     if (!mpd_search_commit(connection)) {
-        syslog(LOG_WARNING, "Unable to execute mpd search!");
         return -1;
     }
 
     while ((pair = mpd_recv_pair_tag(connection, tag)) != NULL) {
+        if (err == 0 && tag_list_add(list, pair->value) == -1) {
+            syslog(LOG_ERR, "Out of memory while reading tags!");
+            err = -1;
+        }
         mpd_return_pair(connection, pair);
     }
 
-    if (!mpd_run_play(connection)) {
-        syslog(LOG_WARNING, "Unable to start playback!");
+    if (!mpd_response_finish(connection) || err == -1) {
+        tag_list_clear(list);
         return -1;
     }
 
+    qsort_r(list->tags, list->count, sizeof(struct tag), comp, list->strings);
+
     return 0;
 }
 
-int change_volume(struct mpd_connection * connection, int delta)
+/* Read the mixer volume on the notification connection, while not idle */
+void read_mixer_volume(struct mpd_connection * connection)
 {
-    int volume;
     struct mpd_status * status;
 
     status = mpd_run_status(connection);
     if (!status) {
+        mixer_volume = -1;
+        return;
+    }
+
+    mixer_volume = mpd_status_get_volume(status);
+    mpd_status_free(status);
+}
+
+/* Open the notification connection, and wait for database and mixer changes on it */
+struct mpd_connection * get_idle_connection()
+{
+    struct mpd_connection * connection;
+
+    connection = mpd_connection_new(NULL, 0, 0);
+    if (!connection) {
+        return NULL;
+    }
+
+    if (mpd_connection_get_error(connection) == MPD_ERROR_SUCCESS) {
+        read_mixer_volume(connection);
+    }
+
+    if (mpd_connection_get_error(connection) != MPD_ERROR_SUCCESS ||
+        !mpd_send_idle_mask(connection, IDLE_EVENTS)) {
+        syslog(LOG_WARNING, "Failed to set up mpd notification connection: %s", mpd_connection_get_error_message(connection));
+        mpd_connection_free(connection);
+        mixer_volume = -1;
+        return NULL;
+    }
+
+    return connection;
+}
+
+void tag_cache_invalidate()
+{
+    size_t i;
+
+    cache.artists.valid = false;
+    cache.unknown_artist_albums.valid = false;
+    for (i = 0; i < cache.albums_count; i++) {
+        cache.albums[i].valid = false;
+    }
+}
+
+/* Apply changes reported on the notification connection, once its socket is
+ * readable: a database change drops the cached tables, and a mixer change
+ * updates the local volume. Without a working notification connection,
+ * changes can not be seen, so the tables are dropped on every use and the
+ * volume is asked for until the main loop has reconnected. */
+void check_idle_events()
+{
+    enum mpd_idle events;
+
+    events = mpd_recv_idle(idle_connection, false);
+    if (events & MPD_IDLE_DATABASE) {
+        syslog(LOG_INFO, "mpd database changed, dropping sorted tag tables.");
+        tag_cache_invalidate();
+    }
+    if (events & MPD_IDLE_MIXER) {
+        read_mixer_volume(idle_connection);
+    }
+
+    if (events == 0 || !mpd_send_idle_mask(idle_connection, IDLE_EVENTS)) {
+        syslog(LOG_WARNING, "Lost mpd notification connection.");
+        mpd_connection_free(idle_connection);
+        idle_connection = NULL;
+        tag_cache_invalidate();
+        mixer_volume = -1;
+    }
+}
+
+struct tag_list * get_artist_table(struct mpd_connection * connection)
+{
+    struct tag_list * albums;
+    size_t i;
+
+    if (cache.artists.valid) {
+        return &cache.artists;
+    }
+
+    if (get_sorted_tags(connection, &cache.artists, MPD_TAG_ARTIST, NULL) == -1) {
+        return NULL;
+    }
+
+    /* One album table per artist, keeping the buffers of existing ones */
+    if (cache.artists.count > cache.albums_count) {
+        albums = realloc(cache.albums, cache.artists.count * sizeof(struct tag_list));
+        if (!albums) {
+            return NULL;
+        }
+        memset(albums + cache.albums_count, 0, (cache.artists.count - cache.albums_count) * sizeof(struct tag_list));
+        cache.albums = albums;
+        cache.albums_count = cache.artists.count;
+    }
+    for (i = 0; i < cache.albums_count; i++) {
+        cache.albums[i].valid = false;
+    }
+
+    cache.artists.valid = true;
+    syslog(LOG_INFO, "Cached %zu artists.", cache.artists.count);
+
+    return &cache.artists;
+}
+
+struct tag_list * get_album_table(struct mpd_connection * connection, const char * artist)
+{
+    struct tag_list * artists;
+    struct tag_list * albums;
+    long index;
+
+    if (!artist) {
+        albums = &cache.unknown_artist_albums;
+    } else {
+        if (!(artists = get_artist_table(connection))) {
+            return NULL;
+        }
+        if ((index = tag_list_find(artists, artist)) == -1) {
+            return NULL;
+        }
+        albums = &cache.albums[index];
+    }
+
+    if (albums->valid) {
+        return albums;
+    }
+
+    if (get_sorted_tags(connection, albums, MPD_TAG_ALBUM, artist) == -1) {
+        return NULL;
+    }
+    albums->valid = true;
+
+    return albums;
+}
+
+/* Returns the tag value `delta` steps away from the current song's, or NULL.
+ * The value is stored in a cached table, and valid until the next lookup. */
+const char * get_next_in_line(struct mpd_connection * connection, int delta, enum mpd_tag_type tag)
+{
+    struct mpd_song * song;
+    struct tag_list * list;
+    const char * tag_content;
+    long pos = -1;
+    long total;
+
+    song = mpd_run_current_song(connection);
+    if (!song) {
+        return NULL;
+    }
+
+    if (!idle_connection) {
+        tag_cache_invalidate();
+    }
+
+    if (tag == MPD_TAG_ALBUM) {
+        list = get_album_table(connection, mpd_song_get_tag(song, MPD_TAG_ARTIST, 0));
+    } else {
+        list = get_artist_table(connection);
+    }
+
+    if (!list) {
+        syslog(LOG_WARNING, "Could not retrieve a list of tags from the mpd server!");
+        mpd_song_free(song);
+        return NULL;
+    }
+
+    tag_content = mpd_song_get_tag(song, tag, 0);
+    if (tag_content) {
+        pos = tag_list_find(list, tag_content);
+    }
+
+    mpd_song_free(song);
+
+    if (pos == -1) {
+        return NULL;
+    }
+
+    total = list->count;
+    pos = ((pos + delta) % total + total) % total;
+
+    return tag_list_name(list, pos);
+}
+
+/* Jump to the next or previous song group, based on tag */
+int jump_to(struct mpd_connection * connection, enum mpd_tag_type tag, int delta)
+{
+    struct batch batch;
+    const char * next;
+
+    if ((next = get_next_in_line(connection, delta, tag)) == NULL) {
+        syslog(LOG_WARNING, "Failed to get next tag in line!");
+        return -1;
+    }
+
+    if (batch_begin(&batch, connection) == -1) {
         return -1;
     }
 
-    volume = mpd_status_get_volume(status);
+    /* Replace the queue and start playback in a single round trip */
+    if (batch_add(&batch, "clear", mpd_send_clear(connection)) == -1 ||
+        batch_add(&batch, "findadd",
+                  mpd_search_add_db_songs(connection, true) &&
+                  mpd_search_add_tag_constraint(connection, MPD_OPERATOR_DEFAULT, tag, next) &&
+                  mpd_search_commit(connection)) == -1 ||
+        batch_add(&batch, "play", mpd_send_play(connection)) == -1) {
+        syslog(LOG_WARNING, "Unable to queue mpd commands!");
+        return BATCH_UNFINISHED;
+    }
+
+    if (batch_run(&batch) == -1) {
+        syslog(LOG_WARNING, "Unable to start playback of the next group!");
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Change the volume relative to the mixer volume tracked from idle events,
+ * falling back to asking mpd when it is unknown */
+int change_volume(struct mpd_connection * connection, int delta)
+{
+    int volume;
+    struct mpd_status * status;
+
+    volume = mixer_volume;
     if (volume == -1) {
-        syslog(LOG_WARNING, "Cannot set mpd volume: no volume support");
+        status = mpd_run_status(connection);
+        if (!status) {
+            return -1;
+        }
+        volume = mpd_status_get_volume(status);
         mpd_status_free(status);
+    }
+
+    if (volume == -1) {
+        syslog(LOG_WARNING, "Cannot set mpd volume: no volume support");
         return -1;
     }
 
@@ -266,8 +761,43 @@ int change_volume(struct mpd_connection * connection, int delta)
         volume = 100;
     }
 
+    if (!mpd_run_set_volume(connection, volume)) {
+        return -1;
+    }
+
+    /* The mixer event caused by this will confirm the new volume */
+    if (idle_connection) {
+        mixer_volume = volume;
+    }
+
+    return 0;
+}
+
+/* Seek within the current song, relative to the current position */
+int seek_relative(struct mpd_connection * connection, int delta)
+{
+    struct mpd_status * status;
+    int id;
+    int position;
+
+    status = mpd_run_status(connection);
+    if (!status) {
+        return -1;
+    }
+
+    id = mpd_status_get_song_id(status);
+    position = mpd_status_get_elapsed_time(status) + delta;
     mpd_status_free(status);
-    return mpd_run_set_volume(connection, volume);
+
+    if (id < 0) {
+        syslog(LOG_NOTICE, "Cannot seek: no current song");
+        return -1;
+    }
+    if (position < 0) {
+        position = 0;
+    }
+
+    return mpd_run_seek_id(connection, id, position);
 }
 
 int toggle_pause(struct mpd_connection * connection)
@@ -297,17 +827,110 @@ int toggle_pause(struct mpd_connection * connection)
     }
 }
 
-/* Command dispatcher */
-void process_cmd(struct mpd_connection * connection, int cmd, const char *params)
+/* Receive a message as a NUL-terminated string, truncated to fit. Returns
+ * its length, or -1 on error or if no message is waiting with ZMQ_DONTWAIT. */
+int receive_message(void * socket, char * buf, size_t size, int flags)
 {
-    int err;
-    int volume_delta;
+    int len;
+
+    len = zmq_recv(socket, buf, size - 1, flags);
+    if (len == -1) {
+        return -1;
+    }
+    if ((size_t)len > size - 1) {
+        len = size - 1;
+    }
+    buf[len] = '\0';
+
+    return len;
+}
+
+/* Add a command to the end of the queue. Volume steps are added up when
+ * queued after each other, so that key repeat results in a single volume
+ * change. */
+void queue_push(struct command_queue * queue, const struct command * command)
+{
+    struct command * last;
+
+    if (queue->count > 0 && command->num == CMD_NUM_VOLUME_STEP) {
+        last = &queue->items[(queue->head + queue->count - 1) % QUEUE_MAX];
+        if (last->num == CMD_NUM_VOLUME_STEP) {
+            last->param += command->param;
+            last->deadline = command->deadline;
+            syslog(LOG_DEBUG, "Coalesced volume step, delta is now %d", last->param);
+            return;
+        }
+    }
+
+    if (queue->count == QUEUE_MAX) {
+        syslog(LOG_WARNING, "Command queue full, dropping command %d", queue->items[queue->head].num);
+        queue->head = (queue->head + 1) % QUEUE_MAX;
+        queue->count--;
+    }
+
+    queue->items[(queue->head + queue->count) % QUEUE_MAX] = *command;
+    queue->count++;
+}
+
+void queue_pop(struct command_queue * queue)
+{
+    queue->head = (queue->head + 1) % QUEUE_MAX;
+    queue->count--;
+}
+
+/* Returns the first command still within its deadline, dropping expired
+ * ones, or NULL if the queue is empty */
+struct command * queue_peek(struct command_queue * queue, unsigned long long now)
+{
+    struct command * command;
 
-    switch(cmd) {
+    while (queue->count > 0) {
+        command = &queue->items[queue->head];
+        if (command->deadline > now) {
+            return command;
+        }
+        syslog(LOG_NOTICE, "Dropping command %d, %llu ms past its deadline", command->num, now - command->deadline);
+        queue_pop(queue);
+    }
+
+    return NULL;
+}
+
+/* Queue all messages waiting on the socket. Returns -1 on socket errors. */
+int receive_commands(void * socket, struct command_queue * queue)
+{
+    struct command command;
+    char buf[128];
+
+    while (receive_message(socket, buf, sizeof(buf), ZMQ_DONTWAIT) != -1) {
+        syslog(LOG_DEBUG, "Received ZeroMQ message: %s", buf);
+
+        /* Look up the command, and validate its parameters */
+        if (parse_command(buf, &command) == -1) {
+            syslog(LOG_NOTICE, "Discarding invalid message: %s", buf);
+            continue;
+        }
+
+        queue_push(queue, &command);
+    }
+
+    if (errno != EAGAIN && errno != EINTR) {
+        syslog(LOG_ERR, "Failed to receive data from ZeroMQ publisher: %s", zmq_strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Command dispatcher. Returns -1 if the connection was left unusable. */
+int process_cmd(struct mpd_connection * connection, const struct command * command)
+{
+    int err = 0;
+
+    switch(command->num) {
         case CMD_NUM_VOLUME_STEP:
-            volume_delta = atoi(params);
-            syslog(LOG_INFO, "Running mpd command: change volume by delta %d", volume_delta);
-            err = change_volume(connection, volume_delta);
+            syslog(LOG_INFO, "Running mpd command: change volume by delta %d", command->param);
+            err = change_volume(connection, command->param);
             break;
         case CMD_NUM_PREV:
             syslog(LOG_INFO, "Running mpd command: change to previous song");
@@ -345,26 +968,54 @@ void process_cmd(struct mpd_connection * connection, int cmd, const char *params
             syslog(LOG_INFO, "Running mpd command: change to next album");
             err = jump_to(connection, MPD_TAG_ALBUM, 1);
             break;
+        case CMD_NUM_SEEK:
+            syslog(LOG_INFO, "Running mpd command: seek by %d seconds", command->param);
+            err = seek_relative(connection, command->param);
+            break;
+        case CMD_NUM_SHUFFLE:
+            syslog(LOG_INFO, "Running mpd command: shuffle queue");
+            err = mpd_run_shuffle(connection);
+            break;
+        case CMD_NUM_PLAY_ID:
+            syslog(LOG_INFO, "Running mpd command: play song id %d", command->param);
+            err = mpd_run_play_id(connection, command->param);
+            break;
         default:
-            syslog(LOG_WARNING, "Unable to run unhandled mpd command %d with params %s", cmd, params);
+            syslog(LOG_WARNING, "Unable to run unhandled mpd command %d", command->num);
             break;
     }
+
+    return err == BATCH_UNFINISHED ? -1 : 0;
 }
 
 int main(int argc, char *argv[])
 {
     int err;
-    int cmd = CMD_NUM_NONE;
-    int errors = 0;
+    struct command_queue queue = { .count = 0 };
+    struct command * cmd;
     struct mpd_connection * connection;
     void * context;
     void * socket;
-    char buf[128];
-    char * params = NULL;
+    zmq_pollitem_t items[3];
+    int count;
+    int mpd_item;
+    int idle_item;
+    long timeout;
+    unsigned long long now;
+    unsigned long long reconnect_at = 0;
+    int reconnect_delay = RECONNECT_MIN_MS;
+    bool playing = false;
 
     /* Syslog initialization */
     openlog("cmpd", LOG_PID, LOG_DAEMON);
     syslog(LOG_INFO, "cmpd initializing.");
+    bootmark("cmpd", "start", false);
+
+    collation_init();
+
+    if (check_commands() == -1) {
+        return EXIT_FAILURE;
+    }
 
     /* Create ZeroMQ context */
     context = zmq_ctx_new();
@@ -381,7 +1032,7 @@ int main(int argc, char *argv[])
     }
 
     /* Subscribe to everything */
-    if (zmq_setsockopt(socket, ZMQ_SUBSCRIBE, "MPD ", 4) == -1) {
+    if (zmq_setsockopt(socket, ZMQ_SUBSCRIBE, MSG_PREFIX, strlen(MSG_PREFIX)) == -1) {
         syslog(LOG_EMERG, "Failed to set ZeroMQ socket options: %s", zmq_strerror(errno));
         return EXIT_FAILURE;
     }
@@ -395,61 +1046,134 @@ int main(int argc, char *argv[])
 
     /* Connect to MPD */
     connection = get_mpd_connection();
+    idle_connection = get_idle_connection();
+    bootmark("cmpd", "ready", true);
 
-    /* Main loop */
+    /* Main loop. Commands are queued as they arrive, and run whenever mpd
+     * is connected. The loop only blocks in zmq_poll, which also watches
+     * both mpd connections and wakes up when it is time to reconnect. */
     while (1) {
+        now = now_ms();
 
-        /* Check if MPD returned any errors */
-        err = mpd_connection_get_error(connection);
-        if (err != MPD_ERROR_SUCCESS && !mpd_connection_clear_error(connection)) {
-            syslog(LOG_WARNING, "Could not recover from mpd error, reconnecting.");
-            mpd_connection_free(connection);
-            if (errors++ > 0) {
-                sleep(1);
+        /* Reconnect to MPD, backing off while it is down */
+        if ((!connection || !idle_connection) && now >= reconnect_at) {
+            if (!connection) {
+                connection = get_mpd_connection();
+            }
+            if (!idle_connection && (idle_connection = get_idle_connection())) {
+                /* Changes may have been missed while disconnected */
+                tag_cache_invalidate();
             }
-            connection = get_mpd_connection();
-            continue;
-        }
 
-        /* Reset mpd error count */
-        errors = 0;
+            if (connection && idle_connection) {
+                reconnect_delay = RECONNECT_MIN_MS;
+            } else {
+                reconnect_at = now + reconnect_delay;
+                reconnect_delay *= 2;
+                if (reconnect_delay > RECONNECT_MAX_MS) {
+                    reconnect_delay = RECONNECT_MAX_MS;
+                }
+            }
+        }
 
-        /* If command failed due to MPD error, try re-running it */
-        if (cmd == CMD_NUM_NONE) {
+        /* Run queued commands */
+        while (connection && (cmd = queue_peek(&queue, now_ms()))) {
 
-            /* Receive ZeroMQ message */
-            err = zmq_recv(socket, buf, 128, 0);
-            if (err == -1) {
-                syslog(LOG_ERR, "Failed to receive data from ZeroMQ publisher: %s", zmq_strerror(errno));
+            /* Keep the command for when the connection is back */
+            if (process_cmd(connection, cmd) == -1) {
+                syslog(LOG_WARNING, "Dropping mpd connection with an unfinished command list.");
+                mpd_connection_free(connection);
+                connection = NULL;
                 break;
             }
-            buf[err] = '\0';
-            syslog(LOG_DEBUG, "Received ZeroMQ message: %s", buf);
-
-            /* Deduce if this is a valid command, and locate parameters */
-            cmd = cmd_from_msg(buf + 4, (void**) &params);
-            if (cmd == CMD_NUM_ERROR) {
-                syslog(LOG_NOTICE, "Discarding invalid message");
-                cmd = CMD_NUM_NONE;
+
+            err = mpd_connection_get_error(connection);
+            if (err != MPD_ERROR_SUCCESS) {
+                syslog(LOG_WARNING, "mpd command failed: %s", mpd_connection_get_error_message(connection));
+
+                /* The connection is lost; keep the command for when it is back */
+                if (!mpd_connection_clear_error(connection)) {
+                    syslog(LOG_WARNING, "Could not recover from mpd error, reconnecting.");
+                    mpd_connection_free(connection);
+                    connection = NULL;
+                    break;
+                }
+
+                /* mpd refused the command, and would refuse it again */
+                queue_pop(&queue);
+                continue;
+            }
+
+            /* The first successful unpause is when music starts after boot */
+            if (!playing && (cmd->num == CMD_NUM_UNPAUSE || cmd->num == CMD_NUM_PLAY_PAUSE)) {
+                bootmark("cmpd", "audio", false);
+                playing = true;
+            }
+
+            queue_pop(&queue);
+        }
+
+        /* Wait for messages, mpd events, or the time to reconnect */
+        count = 0;
+        items[count].socket = socket;
+        items[count].fd = 0;
+        items[count].events = ZMQ_POLLIN;
+        count++;
+
+        mpd_item = -1;
+        if (connection) {
+            items[count].socket = NULL;
+            items[count].fd = mpd_connection_get_fd(connection);
+            items[count].events = ZMQ_POLLIN;
+            mpd_item = count++;
+        }
+
+        idle_item = -1;
+        if (idle_connection) {
+            items[count].socket = NULL;
+            items[count].fd = mpd_connection_get_fd(idle_connection);
+            items[count].events = ZMQ_POLLIN;
+            idle_item = count++;
+        }
+
+        timeout = -1;
+        if (!connection || !idle_connection) {
+            now = now_ms();
+            timeout = reconnect_at > now ? (long)(reconnect_at - now) : 0;
+        }
+
+        if (zmq_poll(items, count, timeout) == -1) {
+            if (errno == EINTR) {
                 continue;
             }
+            syslog(LOG_ERR, "Failed to poll for events: %s", zmq_strerror(errno));
+            break;
         }
 
-        /* Run the command */
-        process_cmd(connection, cmd, params);
-        err = mpd_connection_get_error(connection);
-        if (err != MPD_ERROR_SUCCESS) {
-            syslog(LOG_WARNING, "mpd command failed: %s", mpd_connection_get_error_message(connection));
-            continue;
+        if (idle_item != -1 && (items[idle_item].revents & ZMQ_POLLIN)) {
+            check_idle_events();
+        }
+
+        /* Between commands, mpd only sends anything when closing the connection */
+        if (mpd_item != -1 && (items[mpd_item].revents & ZMQ_POLLIN)) {
+            syslog(LOG_WARNING, "mpd closed the connection, reconnecting.");
+            mpd_connection_free(connection);
+            connection = NULL;
         }
 
-        /* Reset command queue */
-        cmd = CMD_NUM_NONE;
+        if ((items[0].revents & ZMQ_POLLIN) && receive_commands(socket, &queue) == -1) {
+            break;
+        }
     }
 
     syslog(LOG_INFO, "cmpd shutting down.");
     zmq_ctx_destroy(context);
-    mpd_connection_free(connection);
+    if (connection) {
+        mpd_connection_free(connection);
+    }
+    if (idle_connection) {
+        mpd_connection_free(idle_connection);
+    }
 
     return 0;
 }
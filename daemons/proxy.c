@@ -2,6 +2,8 @@
 #include <stdlib.h>
 #include <syslog.h>
 
+#include "bootmark.h"
+
 #define PUBLISHER "tcp://0.0.0.0:9090"
 #define SUBSCRIBER "tcp://0.0.0.0:9080"
 
@@ -14,6 +16,7 @@ int main(int argc, char *argv[])
     /* Syslog initialization */
     openlog("proxy", LOG_PID, LOG_DAEMON);
     syslog(LOG_INFO, "ZeroMQ message proxy initializing.");
+    bootmark("proxy", "start", false);
 
     /* Create ZeroMQ context */
     context = zmq_ctx_new();
@@ -52,6 +55,7 @@ int main(int argc, char *argv[])
 
     /* Finally, start the ZeroMQ proxy. This function will always return -1. */
     syslog(LOG_INFO, "ZeroMQ message proxy started.");
+    bootmark("proxy", "ready", true);
     zmq_proxy(sub, pub, NULL);
     syslog(LOG_INFO, "ZeroMQ message proxy terminating: %s", zmq_strerror(errno));
 
@@ -17,6 +17,8 @@
 #include <zmq.h>
 #include <syslog.h>
 
+#include "../bootmark.h"
+
 #define DEBUG_ADC 0
 #define DEBUG 0
 
@@ -576,6 +578,7 @@ int main(int argc, char **argv)
     }
 
     openlog("sigd", LOG_PID, LOG_DAEMON);
+    bootmark("sigd", "start", false);
 
     init_pins();
     init_adc();
@@ -590,6 +593,7 @@ int main(int argc, char **argv)
     clear_opts(&opts);
 
     syslog(LOG_NOTICE, "Caracas daemon started.");
+    bootmark("sigd", "ready", true);
 
     while (opts.running) {
         get_adc_event();
@@ -0,0 +1,142 @@
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+
+#include <string.h>
+
+#include "albumartcache.hpp"
+
+
+#define ALBUMART_FILE_MAGIC "CAR2"
+
+/**
+ * Header of a thumbnail file. Unpadded RGB32 pixel data follows. A zero
+ * width and height records an album without art. The modification time of
+ * the album directory when the entry was stored is kept, so that the entry
+ * is ignored once a cover is added or the files are replaced.
+ */
+struct AlbumArtFileHeader
+{
+    char magic[4];
+    quint32 width;
+    quint32 height;
+    qint64 mtime;
+};
+
+
+AlbumArtCache::AlbumArtCache(int max_bytes, const QString & path_)
+{
+    memory.setMaxCost(max_bytes);
+    path = path_;
+    QDir().mkpath(path);
+}
+
+QString
+AlbumArtCache::key(const QString & uri, const QString & album)
+{
+    QString identity;
+
+    identity = uri.section('/', 0, -2) + "\n" + album;
+
+    return QString::fromLatin1(QCryptographicHash::hash(identity.toUtf8(), QCryptographicHash::Sha1).toHex());
+}
+
+QString
+AlbumArtCache::file_name(const QString & key) const
+{
+    return path + "/" + key;
+}
+
+bool
+AlbumArtCache::find_memory(const QString & key, QPixmap * pixmap)
+{
+    QPixmap * cached;
+
+    if (!(cached = memory.object(key))) {
+        return false;
+    }
+
+    *pixmap = *cached;
+    return true;
+}
+
+void
+AlbumArtCache::insert_memory(const QString & key, const QPixmap & pixmap)
+{
+    int cost;
+
+    if (pixmap.isNull()) {
+        cost = 1;
+    } else {
+        cost = pixmap.width() * pixmap.height() * pixmap.depth() / 8;
+    }
+
+    memory.insert(key, new QPixmap(pixmap), cost);
+}
+
+bool
+AlbumArtCache::find_disk(const QString & key, qint64 mtime, QImage * image) const
+{
+    QFile file(file_name(key));
+    AlbumArtFileHeader header;
+    QImage result;
+    qint64 size;
+
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    if (file.read((char *)&header, sizeof(header)) != sizeof(header) ||
+        memcmp(header.magic, ALBUMART_FILE_MAGIC, sizeof(header.magic)) ||
+        header.mtime != mtime) {
+        return false;
+    }
+
+    if (header.width == 0 || header.height == 0) {
+        *image = QImage();
+        return true;
+    }
+
+    if (header.width > ALBUMART_SIZE * 4 || header.height > ALBUMART_SIZE * 4) {
+        return false;
+    }
+
+    result = QImage(header.width, header.height, QImage::Format_RGB32);
+    size = (qint64)result.bytesPerLine() * result.height();
+    if (file.read((char *)result.bits(), size) != size) {
+        return false;
+    }
+
+    *image = result;
+    return true;
+}
+
+bool
+AlbumArtCache::insert_disk(const QString & key, qint64 mtime, const QImage & image) const
+{
+    QSaveFile file(file_name(key));
+    AlbumArtFileHeader header;
+    QImage rgb;
+
+    if (!image.isNull()) {
+        rgb = image.convertToFormat(QImage::Format_RGB32);
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ALBUMART_FILE_MAGIC, sizeof(header.magic));
+    header.width = rgb.width();
+    header.height = rgb.height();
+    header.mtime = mtime;
+
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+
+    file.write((const char *)&header, sizeof(header));
+    if (!rgb.isNull()) {
+        file.write((const char *)rgb.constBits(), (qint64)rgb.bytesPerLine() * rgb.height());
+    }
+
+    return file.commit();
+}
@@ -0,0 +1,67 @@
+#include <QCache>
+#include <QImage>
+#include <QPixmap>
+#include <QString>
+
+
+#ifndef _GUI_ALBUMARTCACHE_H_
+#define _GUI_ALBUMARTCACHE_H_
+
+
+/**
+ * Size of album art as displayed on the player screen.
+ */
+#define ALBUMART_SIZE 240
+
+/**
+ * Default location of the on-disk thumbnail store, and memory budget of the
+ * in-memory cache, in bytes. The budget is fixed at compile time.
+ */
+#define ALBUMART_CACHE_PATH "/var/cache/caracas/albumart"
+#define ALBUMART_CACHE_BYTES (8 * 1024 * 1024)
+
+
+/**
+ * Two-level cache of album art, scaled to display size.
+ *
+ * The first level is an LRU of pixmaps, bounded by a memory budget. The
+ * second level is an on-disk store of raw RGB32 thumbnails, so that loading
+ * a thumbnail is a plain read with no image decoding or scaling.
+ *
+ * Albums without art are cached too, as null images, so that their files
+ * are not parsed again on every track change.
+ */
+class AlbumArtCache
+{
+public:
+    AlbumArtCache(int max_bytes = ALBUMART_CACHE_BYTES, const QString & path_ = ALBUMART_CACHE_PATH);
+
+    /**
+     * Returns the cache key for the album a track belongs to, made up of
+     * the track's directory and album tag.
+     */
+    static QString key(const QString & uri, const QString & album);
+
+    /**
+     * Look up and store album art. The memory level must only be used from
+     * the GUI thread, while the disk level may be used from any thread.
+     *
+     * Lookups return false on a cache miss. A null image or pixmap records
+     * that the album has no art. Disk entries are stored with the
+     * modification time of the album directory, and only found with the
+     * same time.
+     */
+    bool find_memory(const QString & key, QPixmap * pixmap);
+    void insert_memory(const QString & key, const QPixmap & pixmap);
+    bool find_disk(const QString & key, qint64 mtime, QImage * image) const;
+    bool insert_disk(const QString & key, qint64 mtime, const QImage & image) const;
+
+private:
+    QString file_name(const QString & key) const;
+
+    QCache<QString, QPixmap> memory;
+    QString path;
+};
+
+
+#endif /* _GUI_ALBUMARTCACHE_H_ */
@@ -0,0 +1,180 @@
+#include <QtDebug>
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <QMetaObject>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "albumartloader.hpp"
+#include "tagfile.hpp"
+
+
+AlbumArtLoader::AlbumArtLoader()
+{
+    latest_serial = 0;
+}
+
+void
+AlbumArtLoader::start()
+{
+    moveToThread(&thread);
+    QObject::connect(this, &AlbumArtLoader::load_requested,
+                     this, &AlbumArtLoader::load);
+    QObject::connect(this, &AlbumArtLoader::prefetch_requested,
+                     this, &AlbumArtLoader::queue_prefetch);
+    thread.start(QThread::LowPriority);
+}
+
+int
+AlbumArtLoader::request(const QString & uri, const QString & key)
+{
+    int serial;
+
+    serial = latest_serial.fetchAndAddOrdered(1) + 1;
+    emit load_requested(serial, uri, key);
+
+    return serial;
+}
+
+void
+AlbumArtLoader::prefetch(const QStringList & uris, const QStringList & keys)
+{
+    emit prefetch_requested(uris, keys);
+}
+
+bool
+AlbumArtLoader::is_stale(int serial) const
+{
+    return serial != 0 && serial != latest_serial.loadAcquire();
+}
+
+qint64
+AlbumArtLoader::directory_mtime(const QString & uri)
+{
+    QFileInfo dir(QFileInfo(MPD_MUSIC_PATH + uri).path());
+
+    if (!dir.exists()) {
+        return -1;
+    }
+
+    return dir.lastModified().toMSecsSinceEpoch();
+}
+
+QImage
+AlbumArtLoader::extract(const QString & uri, const QString & key, qint64 mtime, bool * known, int serial)
+{
+    QImage image;
+    TagFile f(MPD_MUSIC_PATH + uri);
+
+    *known = true;
+
+    if (!f.get_album_art(&image, QSize(ALBUMART_SIZE, ALBUMART_SIZE))) {
+        /* Only remember files that were read and have no art, not files
+         * that are missing, e.g. while the music storage is not mounted */
+        *known = mtime != -1 && f.sniff() != TagFile::CONTAINER_UNKNOWN;
+        if (*known) {
+            cache.insert_disk(key, mtime, QImage());
+        }
+        return QImage();
+    }
+
+    /* The user skipped ahead while we were parsing */
+    if (is_stale(serial)) {
+        return QImage();
+    }
+
+    /* Fill the display area, and crop the overflow. The picture was already
+     * decoded at this size, so scaling is only needed for tiny pictures. */
+    image = image.scaled(ALBUMART_SIZE, ALBUMART_SIZE, Qt::KeepAspectRatioByExpanding, Qt::SmoothTransformation);
+    image = image.copy((image.width() - ALBUMART_SIZE) / 2, (image.height() - ALBUMART_SIZE) / 2,
+                       ALBUMART_SIZE, ALBUMART_SIZE);
+
+    cache.insert_disk(key, mtime, image);
+
+    return image;
+}
+
+void
+AlbumArtLoader::load(int serial, QString uri, QString key)
+{
+    QImage image;
+    qint64 mtime;
+    bool known = true;
+
+    if (is_stale(serial)) {
+        return;
+    }
+
+    mtime = directory_mtime(uri);
+    if (!cache.find_disk(key, mtime, &image)) {
+        image = extract(uri, key, mtime, &known, serial);
+        if (is_stale(serial)) {
+            return;
+        }
+    }
+
+    emit loaded(serial, key, image, known);
+}
+
+void
+AlbumArtLoader::queue_prefetch(QStringList uris, QStringList keys)
+{
+    bool idle;
+
+    idle = prefetch_uris.isEmpty();
+    prefetch_uris = uris;
+    prefetch_keys = keys;
+
+    if (idle && !prefetch_uris.isEmpty()) {
+        QMetaObject::invokeMethod(this, "prefetch_next", Qt::QueuedConnection);
+    }
+}
+
+void
+AlbumArtLoader::prefetch_next()
+{
+    QString uri;
+    QString key;
+    QImage image;
+    qint64 mtime;
+    bool known = true;
+
+    if (prefetch_uris.isEmpty()) {
+        return;
+    }
+
+    uri = prefetch_uris.takeFirst();
+    key = prefetch_keys.takeFirst();
+
+    read_ahead(MPD_MUSIC_PATH + uri);
+
+    mtime = directory_mtime(uri);
+    if (!cache.find_disk(key, mtime, &image)) {
+        image = extract(uri, key, mtime, &known);
+    }
+    emit prefetched(key, image, known);
+
+    /* Go back to the event loop between tracks, so that requests for the
+     * current track are served first */
+    if (!prefetch_uris.isEmpty()) {
+        QMetaObject::invokeMethod(this, "prefetch_next", Qt::QueuedConnection);
+    }
+}
+
+void
+AlbumArtLoader::read_ahead(const QString & path)
+{
+    int fd;
+
+    fd = open(QFile::encodeName(path).constData(), O_RDONLY);
+    if (fd < 0) {
+        qDebug() << "Could not open" << path << "for read-ahead";
+        return;
+    }
+
+    /* Asynchronous; the kernel reads the pages in the background */
+    posix_fadvise(fd, 0, ALBUMART_PREFETCH_BYTES, POSIX_FADV_WILLNEED);
+    close(fd);
+}
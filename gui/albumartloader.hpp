@@ -0,0 +1,116 @@
+#include <QAtomicInt>
+#include <QImage>
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QThread>
+
+#include "albumartcache.hpp"
+
+
+#ifndef _GUI_ALBUMARTLOADER_H_
+#define _GUI_ALBUMARTLOADER_H_
+
+
+/**
+ * Where MPD keeps its music files.
+ */
+#define MPD_MUSIC_PATH "/var/lib/mpd/music/"
+
+/**
+ * How much of an upcoming track to ask the kernel to read ahead.
+ */
+#define ALBUMART_PREFETCH_BYTES (4 * 1024 * 1024)
+
+
+/**
+ * Loads album art in a background thread.
+ *
+ * Requests are served from the on-disk thumbnail store if possible.
+ * Otherwise the embedded picture is extracted, decoded and scaled on the
+ * worker thread, and the thumbnail is stored for next time. Only the most
+ * recent request is served; older requests that are still queued when the
+ * user skips ahead are dropped.
+ *
+ * Upcoming tracks can be prefetched: their album art is extracted into the
+ * thumbnail store, and the start of each file is read ahead into the page
+ * cache, so that the track change itself touches no cold storage. Prefetch
+ * work is done one track at a time, between requests, so that it never
+ * delays a request.
+ */
+class AlbumArtLoader : public QObject
+{
+    Q_OBJECT
+
+public:
+    AlbumArtLoader();
+
+    /**
+     * Move the loader to its worker thread and start the event loop.
+     */
+    void start();
+
+    /**
+     * Ask for the album art of a track. Returns the request serial, which
+     * is passed back with the result. Must be called from the GUI thread.
+     */
+    int request(const QString & uri, const QString & key);
+
+    /**
+     * Prefetch the album art and file contents of upcoming tracks. Replaces
+     * any prefetch work that has not been done yet.
+     */
+    void prefetch(const QStringList & uris, const QStringList & keys);
+
+signals:
+    /**
+     * A request has finished. A null image means that the album has no art
+     * if `known` is set, or that the file could not be read, and should be
+     * tried again later, if not.
+     */
+    void loaded(int serial, QString key, QImage image, bool known);
+
+    /**
+     * Album art of an upcoming track is ready.
+     */
+    void prefetched(QString key, QImage image, bool known);
+
+    void load_requested(int serial, QString uri, QString key);
+    void prefetch_requested(QStringList uris, QStringList keys);
+
+private slots:
+    void load(int serial, QString uri, QString key);
+    void queue_prefetch(QStringList uris, QStringList keys);
+    void prefetch_next();
+
+private:
+    bool is_stale(int serial) const;
+
+    /**
+     * Extract, scale and store the album art of a track. Returns a null
+     * image if the track has no art, or if `serial` became stale. That the
+     * track has no art is only stored, and `known` set, if its file could
+     * be read.
+     */
+    QImage extract(const QString & uri, const QString & key, qint64 mtime, bool * known, int serial = 0);
+
+    /**
+     * Returns the modification time of the directory holding a track, in
+     * milliseconds since the epoch, or -1 if it does not exist.
+     */
+    static qint64 directory_mtime(const QString & uri);
+
+    /**
+     * Ask the kernel to read the start of a file into the page cache.
+     */
+    static void read_ahead(const QString & path);
+
+    QThread thread;
+    QAtomicInt latest_serial;
+    AlbumArtCache cache;
+    QStringList prefetch_uris;
+    QStringList prefetch_keys;
+};
+
+
+#endif /* _GUI_ALBUMARTLOADER_H_ */
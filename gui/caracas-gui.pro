@@ -1,15 +1,15 @@
 # Caracas GUI QT project file
 
-CONFIG += debug
+CONFIG += debug c++11
 TEMPLATE = app
 TARGET = caracas-gui
-INCLUDEPATH += . /usr/include/taglib
+INCLUDEPATH += . ../daemons /usr/include/taglib
 QT += core gui widgets svg
-LIBS += -lmarblewidget-qt5 -lmpdclient -ltag
+LIBS += -lmarblewidget-qt5 -lmpdclient -ltag -lsystemd
 
 # Input
-HEADERS = mainscreen.hpp mapscreen.hpp diagnosticscreen.hpp musicscreen.hpp mpdclient.hpp time.hpp tagfile.hpp albumartwidget.hpp playerscreen.hpp listscreen.hpp searchscreen.hpp navigationscreen.hpp
-SOURCES = mainscreen.cpp mapscreen.cpp diagnosticscreen.cpp main.cpp musicscreen.cpp mpdclient.cpp time.cpp tagfile.cpp albumartwidget.cpp playerscreen.cpp listscreen.cpp searchscreen.cpp navigationscreen.cpp
+HEADERS = mainscreen.hpp mapscreen.hpp diagnosticscreen.hpp musicscreen.hpp mpdclient.hpp time.hpp tagfile.hpp albumartwidget.hpp playerscreen.hpp listscreen.hpp searchscreen.hpp navigationscreen.hpp library.hpp albumartcache.hpp albumartloader.hpp mpdcommandlist.hpp listmodel.hpp musicindex.hpp musicsearchscreen.hpp queuemodel.hpp queuescreen.hpp
+SOURCES = mainscreen.cpp mapscreen.cpp diagnosticscreen.cpp main.cpp musicscreen.cpp mpdclient.cpp time.cpp tagfile.cpp albumartwidget.cpp playerscreen.cpp listscreen.cpp searchscreen.cpp navigationscreen.cpp library.cpp albumartcache.cpp albumartloader.cpp mpdcommandlist.cpp listmodel.cpp musicindex.cpp musicsearchscreen.cpp queuemodel.cpp queuescreen.cpp
 
 # Install
 caracas-gui.path = /usr/local/bin/
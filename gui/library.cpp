@@ -0,0 +1,724 @@
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QtDebug>
+
+#include <algorithm>
+#include <locale.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "library.hpp"
+
+
+Library::Library()
+{
+    strings = NULL;
+    artists = NULL;
+    albums = NULL;
+    tracks = NULL;
+    strings_size = 0;
+    n_artists = 0;
+    n_albums = 0;
+    n_tracks = 0;
+    file = NULL;
+    update_time = 0;
+}
+
+Library::~Library()
+{
+    delete file;
+}
+
+/*
+ * The collation locale is opened once, and used through the *_l functions
+ * so that the process locale is left alone.
+ */
+struct Collation
+{
+    Collation()
+    {
+        name = LIBRARY_COLLATE_LOCALE;
+        locale = newlocale(LC_COLLATE_MASK, name, (locale_t)0);
+        if (!locale) {
+            qDebug() << "Collation locale" << name << "is not available, sorting bytewise.";
+            name = "C";
+            locale = newlocale(LC_COLLATE_MASK, name, (locale_t)0);
+        }
+    }
+
+    const char * name;
+    locale_t locale;
+};
+
+static const Collation &
+collation()
+{
+    static Collation collation;
+    return collation;
+}
+
+const char *
+Library::collation_name()
+{
+    return collation().name;
+}
+
+QByteArray
+Library::collation_key(const char * str)
+{
+    QByteArray key;
+    size_t size;
+
+    key.resize(strlen(str) * 4 + 1);
+    size = strxfrm_l(key.data(), str, key.size(), collation().locale);
+    if (size >= (size_t)key.size()) {
+        key.resize(size + 1);
+        strxfrm_l(key.data(), str, key.size(), collation().locale);
+    }
+    key.resize(size);
+
+    return key;
+}
+
+void
+Library::attach(const char * base, quint32 artists_, quint32 albums_, quint32 tracks_, quint32 strings_size_)
+{
+    n_artists = artists_;
+    n_albums = albums_;
+    n_tracks = tracks_;
+    strings_size = strings_size_;
+
+    artists = (const LibraryArtist *)base;
+    base += n_artists * sizeof(LibraryArtist);
+    albums = (const LibraryAlbum *)base;
+    base += n_albums * sizeof(LibraryAlbum);
+    tracks = (const LibraryTrack *)base;
+    base += n_tracks * sizeof(LibraryTrack);
+    strings = base;
+}
+
+qint64
+Library::tables_size() const
+{
+    return (qint64)n_artists * sizeof(LibraryArtist) +
+           (qint64)n_albums * sizeof(LibraryAlbum) +
+           (qint64)n_tracks * sizeof(LibraryTrack) +
+           strings_size;
+}
+
+bool
+Library::validate() const
+{
+    quint32 i;
+
+    if (strings_size > 0 && strings[strings_size - 1] != '\0') {
+        return false;
+    }
+
+    for (i = 0; i < n_artists; i++) {
+        if (artists[i].name >= strings_size ||
+            artists[i].key >= strings_size ||
+            (quint64)artists[i].first_album + artists[i].album_count > n_albums) {
+            return false;
+        }
+    }
+
+    for (i = 0; i < n_albums; i++) {
+        if (albums[i].name >= strings_size ||
+            albums[i].key >= strings_size ||
+            albums[i].artist >= n_artists ||
+            (quint64)albums[i].first_track + albums[i].track_count > n_tracks) {
+            return false;
+        }
+    }
+
+    for (i = 0; i < n_tracks; i++) {
+        if (tracks[i].uri >= strings_size ||
+            tracks[i].title >= strings_size ||
+            tracks[i].album >= n_albums) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+QSharedPointer<const Library>
+Library::open(const QString & path)
+{
+    Library * library;
+    const LibrarySnapshotHeader * header;
+    const char * base;
+    qint64 size;
+
+    library = new Library();
+    library->file = new QFile(path);
+
+    if (!library->file->open(QIODevice::ReadOnly)) {
+        goto fail;
+    }
+
+    size = library->file->size();
+    if (size < (qint64)sizeof(LibrarySnapshotHeader)) {
+        goto fail;
+    }
+
+    if (!(base = (const char *)library->file->map(0, size))) {
+        goto fail;
+    }
+
+    header = (const LibrarySnapshotHeader *)base;
+    if (memcmp(header->magic, LIBRARY_SNAPSHOT_MAGIC, sizeof(header->magic)) ||
+        header->version != LIBRARY_SNAPSHOT_VERSION ||
+        header->header_size != sizeof(LibrarySnapshotHeader)) {
+        qDebug() << "Library snapshot" << path << "has an unknown format.";
+        goto fail;
+    }
+
+    if (strncmp(header->collation, collation_name(), sizeof(header->collation))) {
+        qDebug() << "Library snapshot" << path << "was sorted for another locale.";
+        goto fail;
+    }
+
+    library->update_time = header->db_update;
+    library->attach(base + sizeof(LibrarySnapshotHeader), header->artists,
+                    header->albums, header->tracks, header->strings_size);
+
+    if (size != (qint64)sizeof(LibrarySnapshotHeader) + library->tables_size() || !library->validate()) {
+        qDebug() << "Library snapshot" << path << "is corrupt.";
+        goto fail;
+    }
+
+    qDebug() << "Library snapshot opened:" << library->n_artists << "artists," <<
+                library->n_albums << "albums," << library->n_tracks << "tracks.";
+
+    return QSharedPointer<const Library>(library);
+
+fail:
+    delete library;
+    return QSharedPointer<const Library>();
+}
+
+bool
+Library::save(const QString & path) const
+{
+    LibrarySnapshotHeader header;
+    QSaveFile out(path);
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, LIBRARY_SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = LIBRARY_SNAPSHOT_VERSION;
+    header.header_size = sizeof(LibrarySnapshotHeader);
+    header.db_update = update_time;
+    header.artists = n_artists;
+    header.albums = n_albums;
+    header.tracks = n_tracks;
+    header.strings_size = strings_size;
+    strncpy(header.collation, collation_name(), sizeof(header.collation) - 1);
+
+    QDir().mkpath(QFileInfo(path).absolutePath());
+
+    if (!out.open(QIODevice::WriteOnly)) {
+        qDebug() << "Unable to write library snapshot" << path << ":" << out.errorString();
+        return false;
+    }
+
+    out.write((const char *)&header, sizeof(header));
+    out.write((const char *)artists, tables_size());
+
+    if (!out.commit()) {
+        qDebug() << "Unable to write library snapshot" << path << ":" << out.errorString();
+        return false;
+    }
+
+    return true;
+}
+
+time_t
+Library::db_update() const
+{
+    return update_time;
+}
+
+quint32
+Library::artist_count() const
+{
+    return n_artists;
+}
+
+quint32
+Library::album_count() const
+{
+    return n_albums;
+}
+
+quint32
+Library::track_count() const
+{
+    return n_tracks;
+}
+
+const LibraryArtist &
+Library::artist(quint32 index) const
+{
+    return artists[index];
+}
+
+const LibraryAlbum &
+Library::album(quint32 index) const
+{
+    return albums[index];
+}
+
+const LibraryTrack &
+Library::track(quint32 index) const
+{
+    return tracks[index];
+}
+
+const char *
+Library::string(quint32 offset) const
+{
+    return strings + offset;
+}
+
+QString
+Library::qstring(quint32 offset) const
+{
+    return QString::fromUtf8(strings + offset);
+}
+
+int
+Library::compare(quint32 key_, quint32 name_, const QByteArray & key, const QByteArray & name) const
+{
+    int cmp;
+
+    if ((cmp = strcmp(string(key_), key.constData())) != 0) {
+        return cmp;
+    }
+    return strcmp(string(name_), name.constData());
+}
+
+int
+Library::find_artist(const QString & name) const
+{
+    QByteArray utf8 = name.toUtf8();
+    QByteArray key = collation_key(utf8.constData());
+    quint32 low = 0;
+    quint32 high = n_artists;
+    quint32 mid;
+    int cmp;
+
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        cmp = compare(artists[mid].key, artists[mid].name, key, utf8);
+        if (cmp == 0) {
+            return mid;
+        } else if (cmp < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return -1;
+}
+
+int
+Library::find_album(int artist, const QString & name) const
+{
+    QByteArray utf8 = name.toUtf8();
+    QByteArray key;
+    quint32 low;
+    quint32 high;
+    quint32 mid;
+    int cmp;
+
+    if (artist < 0 || (quint32)artist >= n_artists) {
+        return -1;
+    }
+
+    key = collation_key(utf8.constData());
+    low = artists[artist].first_album;
+    high = low + artists[artist].album_count;
+
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        cmp = compare(albums[mid].key, albums[mid].name, key, utf8);
+        if (cmp == 0) {
+            return mid;
+        } else if (cmp < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return -1;
+}
+
+
+LibraryBuilder::LibraryBuilder()
+{
+    db_update = 0;
+}
+
+void
+LibraryBuilder::clear()
+{
+    directories.clear();
+    pool.clear();
+    keys.clear();
+    db_update = 0;
+}
+
+QByteArray
+LibraryBuilder::intern(const char * str)
+{
+    QByteArray value;
+    QSet<QByteArray>::const_iterator it;
+
+    if (!str) {
+        return value;
+    }
+
+    value = QByteArray(str);
+    it = pool.constFind(value);
+    if (it != pool.constEnd()) {
+        return *it;
+    }
+
+    pool.insert(value);
+    return value;
+}
+
+/*
+ * Collation keys are cached per distinct name, so that each is computed
+ * once, when the name is first seen.
+ */
+QByteArray
+LibraryBuilder::collation_key(const QByteArray & str)
+{
+    QHash<QByteArray, QByteArray>::const_iterator it;
+    QByteArray key;
+
+    it = keys.constFind(str);
+    if (it != keys.constEnd()) {
+        return it.value();
+    }
+
+    key = Library::collation_key(str.constData());
+    keys.insert(str, key);
+    return key;
+}
+
+QByteArray
+LibraryBuilder::top_directory(const char * uri)
+{
+    const char * slash;
+
+    slash = strchr(uri, '/');
+    if (!slash) {
+        return QByteArray();
+    }
+
+    return QByteArray(uri, slash - uri);
+}
+
+void
+LibraryBuilder::add_song(QVector<Song> & songs, const struct mpd_song * song)
+{
+    Song s;
+    const char * track;
+
+    s.uri = QByteArray(mpd_song_get_uri(song));
+    s.artist = intern(mpd_song_get_tag(song, MPD_TAG_ARTIST, 0));
+    s.album = intern(mpd_song_get_tag(song, MPD_TAG_ALBUM, 0));
+    s.artist_key = collation_key(s.artist);
+    s.album_key = collation_key(s.album);
+    s.title = QByteArray(mpd_song_get_tag(song, MPD_TAG_TITLE, 0));
+
+    track = mpd_song_get_tag(song, MPD_TAG_TRACK, 0);
+    s.number = track ? strtoul(track, NULL, 10) : 0;
+
+    songs.push_back(s);
+}
+
+bool
+LibraryBuilder::fetch_directory(struct mpd_connection * connection, const QByteArray & path)
+{
+    struct mpd_entity * entity;
+    QVector<Song> songs;
+
+    if (!mpd_send_list_all_meta(connection, path.constData())) {
+        return false;
+    }
+
+    while ((entity = mpd_recv_entity(connection)) != NULL) {
+        if (mpd_entity_get_type(entity) == MPD_ENTITY_TYPE_SONG) {
+            add_song(songs, mpd_entity_get_song(entity));
+        }
+        mpd_entity_free(entity);
+    }
+
+    if (!mpd_response_finish(connection)) {
+        return false;
+    }
+
+    directories[path].songs = songs;
+    return true;
+}
+
+bool
+LibraryBuilder::fetch_modified_directories(struct mpd_connection * connection, QSet<QByteArray> & dirty)
+{
+    struct mpd_song * song;
+
+    if (!mpd_search_db_songs(connection, false)) {
+        return false;
+    }
+    if (!mpd_search_add_modified_since_constraint(connection, MPD_OPERATOR_DEFAULT, db_update)) {
+        mpd_search_cancel(connection);
+        return false;
+    }
+    if (!mpd_search_commit(connection)) {
+        return false;
+    }
+
+    while ((song = mpd_recv_song(connection)) != NULL) {
+        dirty.insert(top_directory(mpd_song_get_uri(song)));
+        mpd_song_free(song);
+    }
+
+    return mpd_response_finish(connection);
+}
+
+/*
+ * A directory is fetched again if it is new, if its own timestamp changed,
+ * or if it contains songs modified since the previous update. Songs removed
+ * deep inside an otherwise unchanged directory are picked up on the next
+ * full fetch, which happens whenever the builder starts out empty.
+ */
+bool
+LibraryBuilder::update(struct mpd_connection * connection)
+{
+    struct mpd_stats * stats;
+    struct mpd_entity * entity;
+    const struct mpd_directory * directory;
+    QMap<QByteArray, time_t> listing;
+    QMap<QByteArray, time_t>::const_iterator l;
+    QMap<QByteArray, Directory>::iterator it;
+    QVector<Song> root_songs;
+    QSet<QByteArray> dirty;
+    time_t update_time;
+
+    if (!(stats = mpd_run_stats(connection))) {
+        return false;
+    }
+    update_time = mpd_stats_get_db_update_time(stats);
+    mpd_stats_free(stats);
+
+    /* An older database has replaced the one we know, e.g. restored from a
+     * backup; nothing about it can be assumed */
+    if (update_time < db_update) {
+        qDebug() << "MPD database is older than the library index, fetching everything.";
+        clear();
+    }
+
+    /* List top-level directories, and songs in the root directory */
+    if (!mpd_send_list_meta(connection, "")) {
+        return false;
+    }
+
+    while ((entity = mpd_recv_entity(connection)) != NULL) {
+        switch (mpd_entity_get_type(entity)) {
+            case MPD_ENTITY_TYPE_DIRECTORY:
+                directory = mpd_entity_get_directory(entity);
+                listing.insert(QByteArray(mpd_directory_get_path(directory)),
+                               mpd_directory_get_last_modified(directory));
+                break;
+            case MPD_ENTITY_TYPE_SONG:
+                add_song(root_songs, mpd_entity_get_song(entity));
+                break;
+            default:
+                break;
+        }
+        mpd_entity_free(entity);
+    }
+
+    if (!mpd_response_finish(connection)) {
+        return false;
+    }
+
+    if (db_update != 0 && db_update != update_time) {
+        if (!fetch_modified_directories(connection, dirty)) {
+            return false;
+        }
+    }
+
+    /* Forget directories that are gone */
+    it = directories.begin();
+    while (it != directories.end()) {
+        if (!it.key().isEmpty() && !listing.contains(it.key())) {
+            it = directories.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    for (l = listing.constBegin(); l != listing.constEnd(); ++l) {
+        it = directories.find(l.key());
+        if (it == directories.end() || it->last_modified != l.value()) {
+            dirty.insert(l.key());
+        }
+    }
+
+    foreach (const QByteArray & path, dirty) {
+        if (!listing.contains(path)) {
+            continue;
+        }
+        qDebug() << "Fetching library directory" << path;
+        if (!fetch_directory(connection, path)) {
+            return false;
+        }
+        directories[path].last_modified = listing.value(path);
+    }
+
+    directories[QByteArray()].songs = root_songs;
+    db_update = update_time;
+
+    return true;
+}
+
+bool
+LibraryBuilder::song_less(const Song * a, const Song * b)
+{
+    int cmp;
+
+    if ((cmp = qstrcmp(a->artist_key, b->artist_key)) != 0) {
+        return cmp < 0;
+    }
+    if ((cmp = qstrcmp(a->artist, b->artist)) != 0) {
+        return cmp < 0;
+    }
+    if ((cmp = qstrcmp(a->album_key, b->album_key)) != 0) {
+        return cmp < 0;
+    }
+    if ((cmp = qstrcmp(a->album, b->album)) != 0) {
+        return cmp < 0;
+    }
+    if (a->number != b->number) {
+        return a->number < b->number;
+    }
+    return qstrcmp(a->uri, b->uri) < 0;
+}
+
+/*
+ * Append a string to the string table, unless it is already there.
+ */
+static quint32
+add_string(QByteArray & strings, QHash<QByteArray, quint32> & offsets, const QByteArray & str)
+{
+    QHash<QByteArray, quint32>::const_iterator it;
+    quint32 offset;
+
+    it = offsets.constFind(str);
+    if (it != offsets.constEnd()) {
+        return it.value();
+    }
+
+    offset = strings.size();
+    strings.append(str);
+    strings.append('\0');
+    offsets.insert(str, offset);
+
+    return offset;
+}
+
+QSharedPointer<const Library>
+LibraryBuilder::build() const
+{
+    QVector<const Song *> songs;
+    QVector<LibraryArtist> artists;
+    QVector<LibraryAlbum> albums;
+    QVector<LibraryTrack> tracks;
+    QHash<QByteArray, quint32> offsets;
+    QByteArray strings;
+    QMap<QByteArray, Directory>::const_iterator dir;
+    LibraryArtist artist;
+    LibraryAlbum album;
+    LibraryTrack track;
+    const Song * prev = NULL;
+    bool new_artist;
+    bool new_album;
+    Library * library;
+    char * base;
+    int i;
+
+    for (dir = directories.constBegin(); dir != directories.constEnd(); ++dir) {
+        for (i = 0; i < dir->songs.size(); i++) {
+            songs.push_back(&dir->songs[i]);
+        }
+    }
+
+    std::sort(songs.begin(), songs.end(), song_less);
+
+    foreach (const Song * s, songs) {
+        new_artist = !prev || s->artist != prev->artist;
+        new_album = new_artist || s->album != prev->album;
+
+        if (new_artist) {
+            artist.name = add_string(strings, offsets, s->artist);
+            artist.key = add_string(strings, offsets, s->artist_key);
+            artist.first_album = albums.size();
+            artist.album_count = 0;
+            artist.track_count = 0;
+            artists.push_back(artist);
+        }
+
+        if (new_album) {
+            album.name = add_string(strings, offsets, s->album);
+            album.key = add_string(strings, offsets, s->album_key);
+            album.artist = artists.size() - 1;
+            album.first_track = tracks.size();
+            album.track_count = 0;
+            albums.push_back(album);
+            artists.last().album_count++;
+        }
+
+        track.uri = add_string(strings, offsets, s->uri);
+        track.title = add_string(strings, offsets, s->title);
+        track.album = albums.size() - 1;
+        track.number = s->number;
+        tracks.push_back(track);
+
+        albums.last().track_count++;
+        artists.last().track_count++;
+
+        prev = s;
+    }
+
+    /* Lay out all tables in one contiguous buffer, strings last */
+    library = new Library();
+    library->update_time = db_update;
+    library->storage.resize(artists.size() * sizeof(LibraryArtist) +
+                            albums.size() * sizeof(LibraryAlbum) +
+                            tracks.size() * sizeof(LibraryTrack) +
+                            strings.size());
+    base = library->storage.data();
+    library->attach(base, artists.size(), albums.size(), tracks.size(), strings.size());
+
+    memcpy(base, artists.constData(), artists.size() * sizeof(LibraryArtist));
+    base += artists.size() * sizeof(LibraryArtist);
+    memcpy(base, albums.constData(), albums.size() * sizeof(LibraryAlbum));
+    base += albums.size() * sizeof(LibraryAlbum);
+    memcpy(base, tracks.constData(), tracks.size() * sizeof(LibraryTrack));
+    base += tracks.size() * sizeof(LibraryTrack);
+    memcpy(base, strings.constData(), strings.size());
+
+    qDebug() << "Library index built:" << library->n_artists << "artists," <<
+                library->n_albums << "albums," << library->n_tracks << "tracks.";
+
+    return QSharedPointer<const Library>(library);
+}
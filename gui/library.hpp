@@ -0,0 +1,260 @@
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QMap>
+#include <QMetaType>
+#include <QSet>
+#include <QSharedPointer>
+#include <QString>
+#include <QVector>
+
+#include <mpd/client.h>
+#include <time.h>
+
+
+#ifndef _GUI_LIBRARY_H_
+#define _GUI_LIBRARY_H_
+
+
+/**
+ * Location and format version of the persistent library snapshot.
+ */
+#define LIBRARY_SNAPSHOT_PATH "/var/lib/caracas/library.db"
+#define LIBRARY_SNAPSHOT_MAGIC "CRCSLIB"
+#define LIBRARY_SNAPSHOT_VERSION 2
+
+/**
+ * Locale whose collation rules decide the order of artists and albums, so
+ * that Æ, Ø and Å sort after Z. Falls back to byte order if the locale is
+ * not installed.
+ */
+#define LIBRARY_COLLATE_LOCALE "nb_NO.UTF-8"
+
+
+/**
+ * Flat index tables. All names are byte offsets into the string table, and
+ * all cross references are indices into the other tables.
+ *
+ * Artists are sorted by name, albums are sorted by artist and then by name,
+ * and tracks are sorted by album and then by track number. This means that
+ * the albums of an artist, and the tracks of an album, are contiguous.
+ *
+ * Names are ordered by their collation key, a string in the string table
+ * produced by strxfrm(), so that comparing two names is a plain strcmp()
+ * of their keys. Names with equal keys are ordered bytewise.
+ */
+struct LibraryArtist
+{
+    quint32 name;
+    quint32 key;
+    quint32 first_album;
+    quint32 album_count;
+    quint32 track_count;
+};
+
+struct LibraryAlbum
+{
+    quint32 name;
+    quint32 key;
+    quint32 artist;
+    quint32 first_track;
+    quint32 track_count;
+};
+
+struct LibraryTrack
+{
+    quint32 uri;
+    quint32 title;
+    quint32 album;
+    quint32 number;
+};
+
+
+/**
+ * Snapshot file header. The artist, album and track tables and the string
+ * table follow immediately, in the same layout as in memory, so that a
+ * snapshot can be used directly from a read-only memory mapping.
+ *
+ * Collation keys are only valid for the locale they were made with, which
+ * is recorded in the header.
+ */
+struct LibrarySnapshotHeader
+{
+    char magic[8];
+    quint32 version;
+    quint32 header_size;
+    qint64 db_update;
+    quint32 artists;
+    quint32 albums;
+    quint32 tracks;
+    quint32 strings_size;
+    char collation[32];
+};
+
+
+/**
+ * Immutable, pre-sorted index of the MPD music database.
+ *
+ * All lookups are answered locally; name lookups use binary search.
+ */
+class Library
+{
+public:
+    Library();
+    ~Library();
+
+    /**
+     * Open a snapshot file written by save(). The file is memory mapped and
+     * used in place. Returns a null pointer if the file is missing, has the
+     * wrong version, or is corrupt.
+     */
+    static QSharedPointer<const Library> open(const QString & path);
+
+    /**
+     * Atomically write the index to a snapshot file.
+     */
+    bool save(const QString & path) const;
+
+    /**
+     * MPD database update timestamp this index was built from.
+     */
+    time_t db_update() const;
+
+    quint32 artist_count() const;
+    quint32 album_count() const;
+    quint32 track_count() const;
+
+    const LibraryArtist & artist(quint32 index) const;
+    const LibraryAlbum & album(quint32 index) const;
+    const LibraryTrack & track(quint32 index) const;
+
+    /**
+     * Returns the NUL-terminated UTF-8 string at the given offset.
+     */
+    const char * string(quint32 offset) const;
+    QString qstring(quint32 offset) const;
+
+    /**
+     * Returns the index of an artist, or -1 if it does not exist.
+     */
+    int find_artist(const QString & name) const;
+
+    /**
+     * Returns the global index of an album by the given artist, or -1 if it
+     * does not exist.
+     */
+    int find_album(int artist, const QString & name) const;
+
+    /**
+     * Returns the collation key of a UTF-8 string, and the name of the
+     * locale the keys are made for.
+     */
+    static QByteArray collation_key(const char * str);
+    static const char * collation_name();
+
+private:
+    Q_DISABLE_COPY(Library)
+
+    friend class LibraryBuilder;
+
+    /**
+     * Point the tables into a buffer laid out as described above.
+     */
+    void attach(const char * base, quint32 artists_, quint32 albums_, quint32 tracks_, quint32 strings_size_);
+
+    /**
+     * Check that all offsets and indices are within bounds.
+     */
+    bool validate() const;
+
+    qint64 tables_size() const;
+
+    /**
+     * Compare a stored name, given by its key and name offsets, with a
+     * collation key and name, in table order.
+     */
+    int compare(quint32 key_, quint32 name_, const QByteArray & key, const QByteArray & name) const;
+
+    QByteArray storage;
+    QFile * file;
+    time_t update_time;
+
+    const char * strings;
+    const LibraryArtist * artists;
+    const LibraryAlbum * albums;
+    const LibraryTrack * tracks;
+
+    quint32 strings_size;
+    quint32 n_artists;
+    quint32 n_albums;
+    quint32 n_tracks;
+};
+
+
+/**
+ * Reads the MPD database and builds Library snapshots.
+ *
+ * Songs are fetched one top-level directory at a time, which keeps every
+ * response well below MPD's output buffer limit. On later updates, only
+ * top-level directories that were added, changed or contain modified songs
+ * are fetched again.
+ */
+class LibraryBuilder
+{
+public:
+    LibraryBuilder();
+
+    /**
+     * Synchronize with the MPD database. The connection must not be in
+     * IDLE mode. Returns false on MPD errors.
+     */
+    bool update(struct mpd_connection * connection);
+
+    /**
+     * Build a new immutable index from the current song set.
+     */
+    QSharedPointer<const Library> build() const;
+
+    /**
+     * Forget everything, forcing a full fetch on the next update.
+     */
+    void clear();
+
+private:
+    struct Song
+    {
+        QByteArray uri;
+        QByteArray artist;
+        QByteArray artist_key;
+        QByteArray album;
+        QByteArray album_key;
+        QByteArray title;
+        quint32 number;
+    };
+
+    struct Directory
+    {
+        time_t last_modified;
+        QVector<Song> songs;
+    };
+
+    bool fetch_directory(struct mpd_connection * connection, const QByteArray & path);
+    bool fetch_modified_directories(struct mpd_connection * connection, QSet<QByteArray> & dirty);
+    void add_song(QVector<Song> & songs, const struct mpd_song * song);
+    QByteArray intern(const char * str);
+    QByteArray collation_key(const QByteArray & str);
+
+    static QByteArray top_directory(const char * uri);
+    static bool song_less(const Song * a, const Song * b);
+
+    QMap<QByteArray, Directory> directories;
+    QSet<QByteArray> pool;
+    QHash<QByteArray, QByteArray> keys;
+    time_t db_update;
+};
+
+
+Q_DECLARE_METATYPE(QSharedPointer<const Library>)
+
+
+#endif /* _GUI_LIBRARY_H_ */
@@ -0,0 +1,112 @@
+#include "listmodel.hpp"
+
+
+ListModel::ListModel(QObject * parent) : QAbstractListModel(parent)
+{
+    exposed = 0;
+}
+
+void
+ListModel::clear()
+{
+    beginResetModel();
+    strings.clear();
+    library.clear();
+    offsets.clear();
+    exposed = 0;
+    endResetModel();
+}
+
+void
+ListModel::append(const QStringList & rows)
+{
+    int i;
+
+    /* Borrowed strings can not be mixed with owned ones */
+    if (library) {
+        clear();
+    }
+
+    for (i = 0; i < rows.size(); i++) {
+        offsets.push_back(strings.size());
+        strings.append(rows[i].toUtf8());
+        strings.append('\0');
+    }
+
+    /* Fill the first batch right away; the view fetches the rest */
+    if (exposed < LIST_FETCH_SIZE) {
+        fetchMore(QModelIndex());
+    }
+}
+
+void
+ListModel::set_library_strings(QSharedPointer<const Library> library_, const QVector<quint32> & offsets_)
+{
+    beginResetModel();
+    strings.clear();
+    library = library_;
+    offsets = offsets_;
+    exposed = qMin(offsets.size(), LIST_FETCH_SIZE);
+    endResetModel();
+}
+
+const char *
+ListModel::string(int row) const
+{
+    if (library) {
+        return library->string(offsets[row]);
+    }
+    return strings.constData() + offsets[row];
+}
+
+QString
+ListModel::text(int row) const
+{
+    if (row < 0 || row >= exposed) {
+        return QString();
+    }
+    return QString::fromUtf8(string(row));
+}
+
+int
+ListModel::rowCount(const QModelIndex & parent) const
+{
+    if (parent.isValid()) {
+        return 0;
+    }
+    return exposed;
+}
+
+QVariant
+ListModel::data(const QModelIndex & index, int role) const
+{
+    if (role != Qt::DisplayRole || !index.isValid() || index.row() >= exposed) {
+        return QVariant();
+    }
+    return QString::fromUtf8(string(index.row()));
+}
+
+bool
+ListModel::canFetchMore(const QModelIndex & parent) const
+{
+    return !parent.isValid() && exposed < offsets.size();
+}
+
+void
+ListModel::fetchMore(const QModelIndex & parent)
+{
+    int count;
+
+    if (parent.isValid()) {
+        return;
+    }
+
+    count = qMin(offsets.size() - exposed, LIST_FETCH_SIZE);
+    if (count <= 0) {
+        return;
+    }
+
+    beginInsertRows(QModelIndex(), exposed, exposed + count - 1);
+    exposed += count;
+    endInsertRows();
+}
@@ -0,0 +1,74 @@
+#include <QAbstractListModel>
+#include <QByteArray>
+#include <QSharedPointer>
+#include <QStringList>
+#include <QVector>
+
+#include "library.hpp"
+
+
+#ifndef _GUI_LISTMODEL_H_
+#define _GUI_LISTMODEL_H_
+
+
+/**
+ * Number of rows handed to the view at a time.
+ */
+#define LIST_FETCH_SIZE 256
+
+
+/**
+ * List model over a table of NUL-terminated UTF-8 strings.
+ *
+ * Rows are either copied into a single contiguous buffer owned by the
+ * model, or point directly into the string table of a library index, which
+ * is kept alive for as long as the model uses it. No per-row objects are
+ * created; a row is only converted to a QString when the view asks for it,
+ * which it does for visible rows only.
+ *
+ * Rows are exposed to the view in batches of LIST_FETCH_SIZE as it scrolls.
+ */
+class ListModel : public QAbstractListModel
+{
+    Q_OBJECT
+
+public:
+    ListModel(QObject * parent = NULL);
+
+    /**
+     * Remove all rows.
+     */
+    void clear();
+
+    /**
+     * Copy rows to the end of the list.
+     */
+    void append(const QStringList & rows);
+
+    /**
+     * Replace the contents with strings from a library index, given by
+     * their offsets into its string table.
+     */
+    void set_library_strings(QSharedPointer<const Library> library_, const QVector<quint32> & offsets_);
+
+    /**
+     * Returns the text of a row.
+     */
+    QString text(int row) const;
+
+    int rowCount(const QModelIndex & parent = QModelIndex()) const;
+    QVariant data(const QModelIndex & index, int role = Qt::DisplayRole) const;
+    bool canFetchMore(const QModelIndex & parent) const;
+    void fetchMore(const QModelIndex & parent);
+
+private:
+    const char * string(int row) const;
+
+    QByteArray strings;
+    QSharedPointer<const Library> library;
+    QVector<quint32> offsets;
+    int exposed;
+};
+
+
+#endif /* _GUI_LISTMODEL_H_ */
@@ -5,6 +5,23 @@
 
 ListScreen::ListScreen()
 {
+    rows = new ListModel(this);
+    setModel(rows);
+
+    setUniformItemSizes(true);
+    setLayoutMode(QListView::Batched);
+    setBatchSize(LIST_FETCH_SIZE);
+    setEditTriggers(QAbstractItemView::NoEditTriggers);
+
     verticalScrollBar()->setSingleStep(3);
     setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+
+    QObject::connect(this, &QListView::clicked,
+                     this, &ListScreen::row_clicked);
+}
+
+void
+ListScreen::row_clicked(const QModelIndex & index)
+{
+    emit selected(index.row(), rows->text(index.row()));
 }
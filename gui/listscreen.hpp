@@ -1,28 +1,37 @@
 #include <QString>
-#include <QListWidget>
+#include <QListView>
+#include <QModelIndex>
 
 #include <marble/GeoDataCoordinates.h>
 
-#include "mpdclient.hpp"
-#include "albumartwidget.hpp"
+#include "listmodel.hpp"
 
 
 #ifndef _GUI_LISTSCREEN_H_
 #define _GUI_LISTSCREEN_H_
 
 
-class ListScreen : public QListWidget
+/**
+ * Touch friendly list view over a ListModel.
+ *
+ * All rows have the same height, so the view measures a single row and
+ * never walks the whole model to lay it out.
+ */
+class ListScreen : public QListView
 {
     Q_OBJECT
 
 public:
     ListScreen();
+
+    ListModel * rows;
     QList<Marble::GeoDataCoordinates> coordinates;
 
 signals:
-    void selected(QString text);
+    void selected(int row, QString text);
 
-private:
+private slots:
+    void row_clicked(const QModelIndex & index);
 };
 
 
@@ -1,14 +1,21 @@
 #include <QApplication>
+#include <QElapsedTimer>
 #include <QFont>
 
 #include "mainscreen.hpp"
+#include "bootmark.h"
 
 
 int main(int argc, char **argv)
 {
+    QElapsedTimer startup;
+
+    startup.start();
+    bootmark("gui", "start", false);
+
     QApplication app(argc, argv);
 
-    MainScreen *main_screen = new MainScreen;
+    MainScreen *main_screen = new MainScreen(startup);
     
     main_screen->show();
 
@@ -1,11 +1,26 @@
 #include "mainscreen.hpp"
+#include "bootmark.h"
 
 
-MainScreen::MainScreen()
+MainScreen::MainScreen(const QElapsedTimer & startup_)
 {
-    diagnostic_screen = new DiagnosticScreen;
+    QVBoxLayout * layout;
+
+    startup = startup_;
+    painted = false;
+    diagnostic_screen = NULL;
+    map_screen = NULL;
+
     music_screen = new MusicScreen;
-    map_screen = new MapScreen;
+    qDebug() << "Music screen created after" << startup.elapsed() << "ms.";
+
+    /* Containers for the screens that are created later */
+    map_tab = new QWidget;
+    layout = new QVBoxLayout(map_tab);
+    layout->setContentsMargins(0, 0, 0, 0);
+    diagnostic_tab = new QWidget;
+    layout = new QVBoxLayout(diagnostic_tab);
+    layout->setContentsMargins(0, 0, 0, 0);
 
     icon_path = ICON_PATH;
 
@@ -18,6 +33,85 @@ MainScreen::MainScreen()
     setIconSize(QSize(80, 80));
 
     addTab(music_screen, *music_icon, "");
-    addTab(map_screen, *map_icon, "");
-    addTab(diagnostic_screen, *diagnostic_icon, "");
+    addTab(map_tab, *map_icon, "");
+    addTab(diagnostic_tab, *diagnostic_icon, "");
+
+    QObject::connect(this, &QTabWidget::currentChanged,
+                     this, &MainScreen::tab_changed);
+}
+
+void
+MainScreen::paintEvent(QPaintEvent * event)
+{
+    QTabWidget::paintEvent(event);
+
+    if (painted) {
+        return;
+    }
+
+    painted = true;
+    qDebug() << "First frame painted after" << startup.elapsed() << "ms.";
+    bootmark("gui", "frame", true);
+
+    /* Let the frame reach the screen before doing anything heavy */
+    QTimer::singleShot(0, this, &MainScreen::warm_up);
+}
+
+/*
+ * Create one pending screen per call, so that input is handled in between.
+ */
+void
+MainScreen::warm_up()
+{
+    if (!map_screen) {
+        create_map_screen();
+    } else if (!diagnostic_screen) {
+        create_diagnostic_screen();
+    } else {
+        qDebug() << "Interactive after" << startup.elapsed() << "ms.";
+        bootmark("gui", "interactive", false);
+        return;
+    }
+
+    QTimer::singleShot(0, this, &MainScreen::warm_up);
+}
+
+void
+MainScreen::tab_changed(int index)
+{
+    if (widget(index) == map_tab) {
+        create_map_screen();
+    } else if (widget(index) == diagnostic_tab) {
+        create_diagnostic_screen();
+    }
+}
+
+void
+MainScreen::create_map_screen()
+{
+    QElapsedTimer timer;
+
+    if (map_screen) {
+        return;
+    }
+
+    timer.start();
+    map_screen = new MapScreen;
+    map_tab->layout()->addWidget(map_screen);
+    qDebug() << "Map screen created in" << timer.elapsed() << "ms.";
+}
+
+void
+MainScreen::create_diagnostic_screen()
+{
+    QElapsedTimer timer;
+
+    if (diagnostic_screen) {
+        return;
+    }
+
+    timer.start();
+    diagnostic_screen = new DiagnosticScreen;
+    diagnostic_tab->layout()->addWidget(diagnostic_screen);
+    qDebug() << "Diagnostic screen created in" << timer.elapsed() << "ms.";
 }
@@ -5,6 +5,8 @@
 #include <QTabWidget>
 #include <QLabel>
 #include <QTimer>
+#include <QElapsedTimer>
+#include <QPaintEvent>
 
 #include "diagnosticscreen.hpp"
 #include "mapscreen.hpp"
@@ -13,19 +15,45 @@
 
 #define ICON_PATH "/usr/local/lib/caracas/icons/"
 
+/**
+ * Top level tabs.
+ *
+ * Only the music screen is created up front. The map and diagnostic tabs
+ * start out as empty containers, and their screens are created one per
+ * event loop iteration after the first frame has been painted, or right
+ * away if their tab is opened before that.
+ *
+ * `startup` is the clock started when the process began, and is used to
+ * log the time to first frame and the time until all screens are ready.
+ */
 class MainScreen : public QTabWidget
 {
     Q_OBJECT
 
 public:
-    MainScreen();
+    MainScreen(const QElapsedTimer & startup_);
+
+protected:
+    void paintEvent(QPaintEvent * event);
+
+private slots:
+    void warm_up();
+    void tab_changed(int index);
 
 private:
+    void create_map_screen();
+    void create_diagnostic_screen();
 
     DiagnosticScreen * diagnostic_screen;
     MusicScreen * music_screen;
     MapScreen * map_screen;
 
+    QWidget * map_tab;
+    QWidget * diagnostic_tab;
+
+    QElapsedTimer startup;
+    bool painted;
+
     QString icon_path;
 
     QIcon * music_icon;
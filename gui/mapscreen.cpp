@@ -25,7 +25,7 @@ MapScreen::MapScreen()
     QObject::connect(search_manager, static_cast<void (SearchRunnerManager::*)(const QVector<GeoDataPlacemark *> &)>(&SearchRunnerManager::searchResultChanged),
                      this, &MapScreen::search_result_changed);
 
-    QObject::connect(results_screen, &ListScreen::itemClicked,
+    QObject::connect(results_screen, &ListScreen::selected,
                      this, &MapScreen::start_navigation);
 }
 
@@ -69,8 +69,9 @@ void
 MapScreen::search_result_changed(const QVector<GeoDataPlacemark *> &result)
 {
     QString name;
+    QStringList names;
 
-    results_screen->clear();
+    results_screen->rows->clear();
     results_screen->coordinates.clear();
 
     qDebug() << "Start search results";
@@ -79,10 +80,11 @@ MapScreen::search_result_changed(const QVector<GeoDataPlacemark *> &result)
         //if (!mark->hasOsmData() || ((name = mark->osmData().tagValue("name")) == "")) {
             name = m->coordinate().toString(Marble::GeoDataCoordinates::Decimal).trimmed();
         //}
-        results_screen->addItem(name);
+        names.append(name);
         results_screen->coordinates.append(m->coordinate());
         qDebug() << "Search result:" << name;
     }
+    results_screen->rows->append(names);
     qDebug() << "End search results";
 
     if (result.size() == 0) {
@@ -97,7 +99,7 @@ MapScreen::search_result_changed(const QVector<GeoDataPlacemark *> &result)
 }
 
 void
-MapScreen::start_navigation(QListWidgetItem * item)
+MapScreen::start_navigation(int row, QString text)
 {
     GeoDataCoordinates coordinates;
     RoutingManager * rm;
@@ -105,7 +107,9 @@ MapScreen::start_navigation(QListWidgetItem * item)
 
     setCurrentIndex(indexOf(navigation_screen));
 
-    coordinates = results_screen->coordinates[results_screen->row(item)];
+    Q_UNUSED(text);
+
+    coordinates = results_screen->coordinates[row];
 
     rm = navigation_screen->map_widget->model()->routingManager();
     rq = rm->routeRequest();
@@ -33,7 +33,7 @@ public slots:
 
     void search_result_changed(const QVector<GeoDataPlacemark *> &result);
     void perform_search_slot(QString term);
-    void start_navigation(QListWidgetItem * item);
+    void start_navigation(int row, QString text);
     void show_search();
     void hide_search();
     qreal km_to_rad(qreal km);
@@ -1,91 +1,196 @@
 #include "mpdclient.hpp"
 
-#include <unistd.h>
-
 
 MPDPlayerInfo::MPDPlayerInfo()
 {
+    version = 0;
     connected = false;
-    uri = "";
-    title = "";
-    artist = "";
-    album = "";
-    year = "";
-    track = "";
+    song = std::make_shared<const MPDSongInfo>();
+    state = MPD_STATE_UNKNOWN;
     volume = 0;
-    elapsed.setHMS(0, 0, 0);
-    duration.setHMS(0, 0, 0);
+}
+
+Time
+MPDPlayerInfo::elapsed_at(Time now) const
+{
+    Time position;
+
+    position = elapsed;
+    if (state == MPD_STATE_PLAY && now.get_total_ms() > stamp.get_total_ms()) {
+        position.increment_ms(now.get_total_ms() - stamp.get_total_ms());
+    }
+    if (duration.get_total_ms() > 0 && position.get_total_ms() > duration.get_total_ms()) {
+        position = duration;
+    }
+
+    return position;
 }
 
 
 MPDClient::MPDClient()
 {
-    last_uri = "";
+    song_id = MPD_SONG_ID_UNKNOWN;
     connection = NULL;
-    is_idle = false;
-    needs_update = true;
-    info = new MPDPlayerInfo();
+    idle_connection = NULL;
+    notifier = NULL;
+    command_notifier = NULL;
+    reconnect_timer = NULL;
+    idle_reconnect_timer = NULL;
+    reconnect_delay = MPD_RECONNECT_MIN_MS;
+    idle_reconnect_delay = MPD_RECONNECT_MIN_MS;
+    song_pos = -1;
+    queue_version = 0;
+    queue_length = 0;
+    upcoming_pos = -1;
+    upcoming_version = 0;
+    listed_queue_version = 0;
+    pending_events = 0;
+    published = std::make_shared<const MPDPlayerInfo>(info);
+
+    qRegisterMetaType<QSharedPointer<const Library> >();
+    qRegisterMetaType<QVector<quint32> >();
+    qRegisterMetaType<QSharedPointer<const MusicIndex> >();
 }
 
 void
+MPDClient::start()
+{
+    moveToThread(&thread);
+    QObject::connect(&thread, &QThread::started,
+                     this, &MPDClient::init);
+    thread.start();
+}
+
+void
+MPDClient::init()
+{
+    reconnect_timer = new QTimer(this);
+    reconnect_timer->setSingleShot(true);
+    QObject::connect(reconnect_timer, &QTimer::timeout,
+                     this, &MPDClient::reconnect);
+
+    idle_reconnect_timer = new QTimer(this);
+    idle_reconnect_timer->setSingleShot(true);
+    QObject::connect(idle_reconnect_timer, &QTimer::timeout,
+                     this, &MPDClient::reconnect_idle);
+
+    /* Browse from the last known library until MPD has been consulted */
+    library = Library::open(LIBRARY_SNAPSHOT_PATH);
+
+    /* The command connection fetches the initial state when it connects */
+    reconnect_idle();
+    reconnect();
+
+    /* Index the snapshot if connecting did not bring a newer library */
+    if (library && !music_index) {
+        update_music_index();
+    }
+}
+
+bool
 MPDClient::handle_errors()
 {
     enum mpd_error err;
 
     if (!connection) {
-        return;
+        return false;
     }
 
-    mutex.lock();
-
     err = mpd_connection_get_error(connection);
 
     switch(err) {
         case MPD_ERROR_SUCCESS:
-            break;
+            return true;
         case MPD_ERROR_SERVER:
             qDebug() << "MPD returned an error: " << mpd_connection_get_error_message(connection);
-            if (!mpd_connection_clear_error(connection)) {
-                qDebug() << "Disconnecting from MPD due to error: " << mpd_connection_get_error_message(connection);
-                disconnect();
+            if (mpd_connection_clear_error(connection)) {
+                return true;
             }
+            qDebug() << "Disconnecting from MPD due to error: " << mpd_connection_get_error_message(connection);
             break;
         default:
             qDebug() << "Disconnecting from MPD due to error: " << mpd_connection_get_error_message(connection);
-            disconnect();
             break;
     }
 
-    mutex.unlock();
+    connection_lost();
+    return false;
 }
 
 bool
 MPDClient::connect()
 {
     qDebug() << "Connecting to MPD server.";
-    mutex.lock();
     connection = mpd_connection_new(NULL, 0, 0);
-    if (connected_and_ok()) {
-        qDebug() << "Connected.";
-        is_idle = false;
-        needs_update = true;
-        mutex.unlock();
-        return true;
-    }
-    mutex.unlock();
-    return false;
+    if (!connected_and_ok()) {
+        disconnect();
+        return false;
+    }
+
+    qDebug() << "Connected.";
+
+    command_notifier = new QSocketNotifier(mpd_connection_get_fd(connection), QSocketNotifier::Read, this);
+    QObject::connect(command_notifier, &QSocketNotifier::activated,
+                     this, &MPDClient::command_socket_activated);
+
+    /* The current song, the announced upcoming entries and the library
+     * builder are kept. MPD closes idle command connections regularly, and
+     * reconnecting compares them with the server anyway. */
+    return true;
 }
 
 void
 MPDClient::disconnect()
 {
-    qDebug() << "Disconnecting from MPD server.";
     if (!connection) {
         return;
     }
-    mutex.lock();
+    qDebug() << "Disconnecting from MPD server.";
+    if (command_notifier) {
+        command_notifier->setEnabled(false);
+        command_notifier->deleteLater();
+        command_notifier = NULL;
+    }
     mpd_connection_free(connection);
-    mutex.unlock();
+    connection = NULL;
+}
+
+bool
+MPDClient::connect_idle()
+{
+    qDebug() << "Connecting to MPD server for notifications.";
+    idle_connection = mpd_connection_new(NULL, 0, 0);
+    if (!idle_connection || mpd_connection_get_error(idle_connection) != MPD_ERROR_SUCCESS) {
+        disconnect_idle();
+        return false;
+    }
+
+    notifier = new QSocketNotifier(mpd_connection_get_fd(idle_connection), QSocketNotifier::Read, this);
+    QObject::connect(notifier, &QSocketNotifier::activated,
+                     this, &MPDClient::socket_activated);
+
+    if (!idle()) {
+        disconnect_idle();
+        return false;
+    }
+
+    return true;
+}
+
+void
+MPDClient::disconnect_idle()
+{
+    if (!idle_connection) {
+        return;
+    }
+    qDebug() << "Disconnecting notification connection from MPD server.";
+    if (notifier) {
+        notifier->setEnabled(false);
+        notifier->deleteLater();
+        notifier = NULL;
+    }
+    mpd_connection_free(idle_connection);
+    idle_connection = NULL;
 }
 
 bool
@@ -96,217 +201,514 @@ MPDClient::connected_and_ok()
     return rc;
 }
 
-bool
-MPDClient::has_idle_events(long timeout_ms)
+void
+MPDClient::finish_list(const MPDCommandList & list)
 {
-    fd_set pollfd;
-    struct timeval timeout;
-    int mpd_fd;
-    int nfds;
-    int rc;
+    if (list.is_open()) {
+        qDebug() << "Dropping MPD connection with an unfinished command list.";
+        connection_lost();
+        return;
+    }
 
-    mutex.lock();
+    handle_errors();
+}
 
-    FD_ZERO(&pollfd);
+void
+MPDClient::connection_lost()
+{
+    disconnect();
 
-    if ((mpd_fd = mpd_connection_get_fd(connection)) != -1) {
-        FD_SET(mpd_fd, &pollfd);
-    } else {
-        mutex.unlock();
-        return false;
+    info.connected = false;
+    publish(MPD_CHANGED_CONNECTION);
+
+    /* The queue may be entirely different once connected again */
+    listed_queue_version = 0;
+
+    if (!reconnect_timer->isActive()) {
+        reconnect_timer->start(reconnect_delay);
     }
+}
+
+void
+MPDClient::reconnect()
+{
+    unsigned events;
 
-    nfds = mpd_fd;
+    if (!connect()) {
+        qDebug() << "Unable to connect to MPD, retrying in" << reconnect_delay << "ms.";
+        if (info.connected) {
+            info.connected = false;
+            publish(MPD_CHANGED_CONNECTION);
+        }
+        reconnect_timer->start(reconnect_delay);
+        reconnect_delay = qMin(reconnect_delay * 2, MPD_RECONNECT_MAX_MS);
+        return;
+    }
 
-    timeout.tv_sec = timeout_ms / 1000;
-    timeout.tv_usec = (timeout_ms * 1000) - (timeout.tv_sec * 1000000);
+    reconnect_delay = MPD_RECONNECT_MIN_MS;
+    info.connected = true;
+
+    /* Catch up on events that arrived while disconnected. The status is
+     * always fetched, and the library compared with the database, since
+     * the notification connection may have been down as well. */
+    events = pending_events | MPD_IDLE_STATUS;
+    pending_events = 0;
+    handle_events(events);
+    if (connection && !(events & MPD_IDLE_DATABASE)) {
+        update_library();
+    }
+}
 
-    rc = select(++nfds, &pollfd, NULL, NULL, &timeout);
+void
+MPDClient::idle_connection_lost()
+{
+    disconnect_idle();
 
-    if (rc == EINVAL || rc == -1) {
-        mutex.unlock();
-        return false;
+    if (!idle_reconnect_timer->isActive()) {
+        idle_reconnect_timer->start(idle_reconnect_delay);
     }
+}
 
-    mutex.unlock();
+void
+MPDClient::reconnect_idle()
+{
+    if (!connect_idle()) {
+        qDebug() << "Unable to connect to MPD for notifications, retrying in" << idle_reconnect_delay << "ms.";
+        idle_reconnect_timer->start(idle_reconnect_delay);
+        idle_reconnect_delay = qMin(idle_reconnect_delay * 2, MPD_RECONNECT_MAX_MS);
+        return;
+    }
 
-    return (rc > 0) && FD_ISSET(mpd_fd, &pollfd);
+    idle_reconnect_delay = MPD_RECONNECT_MIN_MS;
+
+    /* Events may have been missed while the connection was down */
+    handle_events(MPD_IDLE_STATUS | MPD_IDLE_DATABASE);
 }
 
-bool
-MPDClient::update_player_info()
+std::shared_ptr<const MPDPlayerInfo>
+MPDClient::snapshot() const
+{
+    return std::atomic_load(&published);
+}
+
+void
+MPDClient::publish(unsigned changed)
+{
+    info.version++;
+    std::atomic_store(&published, std::make_shared<const MPDPlayerInfo>(info));
+    emit player_changed(changed);
+}
+
+void
+MPDClient::refresh(unsigned events)
+{
+    unsigned changed;
+
+    if (!update_player_info(events, &changed)) {
+        handle_errors();
+        return;
+    }
+
+    /* Song tags are shared with the previous snapshot unless they changed */
+    if (changed) {
+        publish(changed);
+    }
+
+    if (events & (MPD_IDLE_PLAYER | MPD_IDLE_QUEUE)) {
+        update_upcoming();
+    }
+
+    if (events & MPD_IDLE_QUEUE) {
+        update_queue();
+    }
+}
+
+void
+MPDClient::update_upcoming()
 {
     struct mpd_song * song;
-    struct mpd_status * status;
+    QStringList uris;
+    QStringList albums;
+    unsigned start;
+    unsigned end;
+
+    if (song_pos == upcoming_pos && queue_version == upcoming_version) {
+        return;
+    }
 
-    qDebug() << "Retrieving status and current song from MPD server.";
+    upcoming_pos = song_pos;
+    upcoming_version = queue_version;
 
-    mutex.lock();
+    start = song_pos + 1;
+    end = qMin(start + MPD_PREFETCH_COUNT, queue_length);
 
-    song = mpd_run_current_song(connection);
-    if (!connected_and_ok()) {
-        mutex.unlock();
-        return false;
+    if (song_pos >= 0 && start < end) {
+        if (!mpd_send_list_queue_range_meta(connection, start, end)) {
+            handle_errors();
+            return;
+        }
+        while ((song = mpd_recv_song(connection)) != NULL) {
+            uris.push_back(QString::fromUtf8(mpd_song_get_uri(song)));
+            albums.push_back(QString::fromUtf8(mpd_song_get_tag(song, MPD_TAG_ALBUM, 0)));
+            mpd_song_free(song);
+        }
+        if (!mpd_response_finish(connection)) {
+            handle_errors();
+            return;
+        }
     }
 
-    if (song) {
-        info->uri = mpd_song_get_uri(song);
-        info->title = mpd_song_get_tag(song, MPD_TAG_TITLE, 0);
-        info->artist = mpd_song_get_tag(song, MPD_TAG_ARTIST, 0);
-        info->album = mpd_song_get_tag(song, MPD_TAG_ALBUM, 0);
-        info->year = mpd_song_get_tag(song, MPD_TAG_DATE, 0);
-        info->track = mpd_song_get_tag(song, MPD_TAG_TRACK, 0);
+    emit upcoming_changed(uris, albums);
+}
+
+void
+MPDClient::update_queue()
+{
+    QVector<quint32> positions;
+    unsigned position;
+    unsigned id;
+
+    if (queue_version == listed_queue_version) {
+        return;
+    }
+
+    /* Without a known version to start from, the GUI starts over */
+    if (listed_queue_version == 0) {
+        listed_queue_version = queue_version;
+        emit queue_changed(queue_length, positions, true);
+        return;
+    }
+
+    if (!mpd_send_queue_changes_brief(connection, listed_queue_version)) {
+        handle_errors();
+        return;
+    }
+    while (mpd_recv_queue_change_brief(connection, &position, &id)) {
+        positions.push_back(position);
+    }
+    if (!mpd_response_finish(connection)) {
+        handle_errors();
+        return;
+    }
+
+    qDebug() << "Queue version" << queue_version << "has" << positions.size() << "changed entries.";
+
+    listed_queue_version = queue_version;
+    emit queue_changed(queue_length, positions, false);
+}
+
+void
+MPDClient::request_queue_page(unsigned start, unsigned end)
+{
+    struct mpd_song * song;
+    QStringList rows;
+    const char * artist;
+    const char * title;
+
+    if (!connection) {
+        return;
+    }
+
+    /* The GUI may ask for entries that were removed in the meantime */
+    end = qMin(end, queue_length);
+    if (start >= end) {
+        return;
+    }
+
+    if (!mpd_send_list_queue_range_meta(connection, start, end)) {
+        handle_errors();
+        return;
+    }
+    while ((song = mpd_recv_song(connection)) != NULL) {
+        artist = mpd_song_get_tag(song, MPD_TAG_ARTIST, 0);
+        title = mpd_song_get_tag(song, MPD_TAG_TITLE, 0);
+        if (artist && title) {
+            rows.push_back(QString::fromUtf8(artist) + " - " + QString::fromUtf8(title));
+        } else {
+            rows.push_back(QString::fromUtf8(mpd_song_get_uri(song)));
+        }
         mpd_song_free(song);
-    } else {
-        info->title.clear();
-        info->artist.clear();
-        info->album.clear();
-        info->year.clear();
-        info->track.clear();
+    }
+    if (!mpd_response_finish(connection)) {
+        handle_errors();
+        return;
     }
 
-    if (!(status = mpd_run_status(connection))) {
-        mutex.unlock();
-        return false;
+    emit queue_page(start, rows);
+}
+
+void
+MPDClient::socket_activated()
+{
+    mpd_idle events;
+
+    qDebug() << "Received data on MPD notification connection.";
+
+    events = receive_idle_updates();
+    if (mpd_connection_get_error(idle_connection) != MPD_ERROR_SUCCESS) {
+        qDebug() << "Lost MPD notification connection:" << mpd_connection_get_error_message(idle_connection);
+        idle_connection_lost();
+        return;
     }
 
-    info->duration.set_total_ms(mpd_status_get_total_time(status) * 1000);
-    info->elapsed.set_total_ms(mpd_status_get_elapsed_ms(status));
-    info->volume = mpd_status_get_volume(status);
-    info->state = mpd_status_get_state(status);
+    /* Park the connection again before handling the events, so that no
+     * event can slip through while the command connection is busy */
+    if (!idle()) {
+        idle_connection_lost();
+    }
 
-    mpd_status_free(status);
+    handle_events(events);
+}
 
-    /* Start elapsed timer if playing */
-    if (info->state == MPD_STATE_PLAY) {
-        timer.start();
+void
+MPDClient::command_socket_activated()
+{
+    /* Replies are read synchronously by the commands themselves, so this
+     * is MPD hanging up, typically after its connection_timeout. Reconnect
+     * right away, so that the next command does not fail. */
+    qDebug() << "MPD closed the command connection, reconnecting.";
+    disconnect();
+    reconnect();
+}
+
+void
+MPDClient::handle_events(unsigned events)
+{
+    /* Commands are not possible until the command connection is back,
+     * which handles the events then */
+    if (!connection) {
+        pending_events |= events;
+        return;
     }
 
-    mutex.unlock();
-    return true;
+    /* Tags of the current song may have been changed by a rescan */
+    if (events & MPD_IDLE_DATABASE) {
+        song_id = MPD_SONG_ID_UNKNOWN;
+        events |= MPD_IDLE_PLAYER;
+    }
+
+    if (events & MPD_IDLE_STATUS) {
+        refresh(events);
+    }
+    if (connection && (events & MPD_IDLE_DATABASE)) {
+        update_library();
+    }
 }
 
 bool
-MPDClient::progress_time()
+MPDClient::update_song()
 {
-    if (info->state != MPD_STATE_PLAY) {
+    struct mpd_song * song;
+    std::shared_ptr<MPDSongInfo> tags;
+
+    qDebug() << "Retrieving current song from MPD server.";
+
+    song = mpd_run_current_song(connection);
+    if (!connected_and_ok()) {
         return false;
     }
 
-    info->elapsed.increment_ms(timer.restart());
+    tags = std::make_shared<MPDSongInfo>();
+
+    if (song) {
+        tags->uri = mpd_song_get_uri(song);
+        tags->title = mpd_song_get_tag(song, MPD_TAG_TITLE, 0);
+        tags->artist = mpd_song_get_tag(song, MPD_TAG_ARTIST, 0);
+        tags->album = mpd_song_get_tag(song, MPD_TAG_ALBUM, 0);
+        tags->year = mpd_song_get_tag(song, MPD_TAG_DATE, 0);
+        tags->track = mpd_song_get_tag(song, MPD_TAG_TRACK, 0);
+        mpd_song_free(song);
+    } else {
+        tags->uri = info.song->uri;
+    }
+
+    info.song = tags;
+
     return true;
 }
 
-void
-MPDClient::run()
+bool
+MPDClient::update_player_info(unsigned events, unsigned * changed)
 {
-    mpd_idle events;
-
-    while (1)
-    {
-        handle_errors();
+    struct mpd_status * status;
+    int volume;
+    int current_id;
 
-        usleep(10000);
+    *changed = 0;
 
-        mutex.lock();
-        info->connected = connected_and_ok();
-        mutex.unlock();
+    qDebug() << "Retrieving status from MPD server.";
 
-        if (!info->connected) {
-            if (!connect()) {
-                emit info_changed(info);
-                emit elapsed_changed(info);
-                sleep(1);
-                continue;
-            }
-        }
+    if (!(status = mpd_run_status(connection))) {
+        return false;
+    }
 
-        if (needs_update) {
-            if (!update_player_info()) {
-                continue;
-            }
-            needs_update = false;
-            emit info_changed(info);
-            emit elapsed_changed(info);
-            if (info->uri != last_uri) {
-                emit uri_changed(info);
-                last_uri = info->uri;
-            }
+    if (events & MPD_IDLE_MIXER) {
+        volume = mpd_status_get_volume(status);
+        if (volume != info.volume) {
+            info.volume = volume;
+            *changed |= MPD_CHANGED_VOLUME;
         }
+    }
 
-        if (!is_idle) {
-            idle();
-            continue;
-        }
+    if (events & (MPD_IDLE_PLAYER | MPD_IDLE_QUEUE)) {
+        info.duration.set_total_ms(mpd_status_get_total_time(status) * 1000);
+        info.elapsed.set_total_ms(mpd_status_get_elapsed_ms(status));
+        info.stamp = Time::now();
+        info.state = mpd_status_get_state(status);
+        *changed |= MPD_CHANGED_ELAPSED;
+
+        song_pos = mpd_status_get_song_pos(status);
+        queue_version = mpd_status_get_queue_version(status);
+        queue_length = mpd_status_get_queue_length(status);
+        current_id = mpd_status_get_song_id(status);
+    } else {
+        current_id = song_id;
+    }
 
-        if (has_idle_events(200)) {
-            qDebug() << "Received data on MPD connection.";
-            events = receive_idle_updates();
-            if (events == 0) {
-                continue;
-            }
-            if (events & (MPD_IDLE_PLAYER | MPD_IDLE_MIXER)) {
-                needs_update = true;
-            }
-        }
+    mpd_status_free(status);
 
-        if (progress_time()) {
-            emit elapsed_changed(info);
+    /* Only fetch tags when another song has become current */
+    if (current_id != song_id) {
+        if (!update_song()) {
+            return false;
         }
+        song_id = current_id;
+        *changed |= MPD_CHANGED_SONG;
     }
+
+    return true;
 }
 
 bool
 MPDClient::idle()
 {
-    qDebug() << "Putting MPD client in IDLE mode...";
-    if (!mpd_send_idle(connection)) {
-        return false;
-    }
-    qDebug() << "IDLE mode activated.";
-    is_idle = true;
-    return true;
+    qDebug() << "Waiting for MPD events...";
+    return mpd_send_idle_mask(idle_connection, (enum mpd_idle)(MPD_IDLE_STATUS | MPD_IDLE_DATABASE));
 }
 
 mpd_idle
 MPDClient::receive_idle_updates()
 {
     mpd_idle rc;
-    qDebug() << "Exiting IDLE mode...";
-    rc = mpd_recv_idle(connection, true);
-    if (connected_and_ok()) {
-        qDebug() << "Exited IDLE mode with flags" << rc;
-        is_idle = false;
-    }
+    rc = mpd_recv_idle(idle_connection, false);
+    qDebug() << "Received MPD events with flags" << rc;
     return rc;
 }
 
-bool
-MPDClient::noidle()
+void
+MPDClient::receive_tag_list(int request_id, enum mpd_tag_type tag)
 {
-    if (is_idle) {
-        if (!mpd_send_noidle(connection)) {
-            return false;
+    mpd_pair * pair;
+    QStringList rows;
+
+    rows.reserve(MPD_LIST_CHUNK_SIZE);
+
+    while ((pair = mpd_recv_pair_tag(connection, tag)) != NULL) {
+        rows.push_back(QString::fromUtf8(pair->value));
+        mpd_return_pair(connection, pair);
+        if (rows.size() == MPD_LIST_CHUNK_SIZE) {
+            emit list_chunk(request_id, rows);
+            rows.clear();
         }
-        receive_idle_updates();
     }
 
-    return true;
+    if (!rows.isEmpty()) {
+        emit list_chunk(request_id, rows);
+    }
 }
 
 void
-MPDClient::get_artist_list(QStringList * list)
+MPDClient::update_library()
 {
-    mpd_pair * pair;
+    struct mpd_stats * stats;
+    time_t db_update;
+
+    /* Skip the update if the index matches the MPD database */
+    if (library) {
+        if (!(stats = mpd_run_stats(connection))) {
+            handle_errors();
+            return;
+        }
+        db_update = mpd_stats_get_db_update_time(stats);
+        mpd_stats_free(stats);
 
-    qDebug() << "Fetching a list of artists from MPD server.";
+        if (db_update == library->db_update()) {
+            qDebug() << "Library index is up to date with MPD database.";
+            return;
+        }
+    }
+
+    qDebug() << "Synchronizing library index with MPD database.";
+
+    if (!library_builder.update(connection)) {
+        qDebug() << "Unable to synchronize library index.";
+        handle_errors();
+        return;
+    }
 
-    mutex.lock();
+    library = library_builder.build();
+    library->save(LIBRARY_SNAPSHOT_PATH);
 
-    list->clear();
+    update_music_index();
+}
 
-    if (!noidle()) {
-        qDebug() << "Unable to exit IDLE mode, aborting.";
+void
+MPDClient::update_music_index()
+{
+    music_index = QSharedPointer<const MusicIndex>(new MusicIndex(library));
+    emit music_index_changed(music_index);
+}
+
+void
+MPDClient::send_library_artists(int request_id)
+{
+    QVector<quint32> names;
+    quint32 i;
+
+    names.reserve(library->artist_count());
+
+    for (i = 0; i < library->artist_count(); i++) {
+        names.push_back(library->artist(i).name);
+    }
+
+    emit list_table(request_id, library, names);
+    emit list_finished(request_id);
+}
+
+void
+MPDClient::send_library_albums(int request_id, const QString & artist)
+{
+    QVector<quint32> names;
+    quint32 i;
+    quint32 end;
+    int index;
+
+    index = library->find_artist(artist);
+    if (index != -1) {
+        const LibraryArtist & a = library->artist(index);
+        end = a.first_album + a.album_count;
+        names.reserve(a.album_count);
+        for (i = a.first_album; i < end; i++) {
+            names.push_back(library->album(i).name);
+        }
+    }
+
+    emit list_table(request_id, library, names);
+    emit list_finished(request_id);
+}
+
+void
+MPDClient::request_artist_list(int request_id)
+{
+    if (library) {
+        send_library_artists(request_id);
+        return;
+    }
+
+    qDebug() << "Fetching a list of artists from MPD server, request" << request_id;
+
+    if (!connection) {
+        qDebug() << "Not connected to MPD, aborting.";
         goto end;
     }
     if (!mpd_search_db_tags(connection, MPD_TAG_ARTIST)) {
@@ -318,32 +720,27 @@ MPDClient::get_artist_list(QStringList * list)
         goto end;
     }
 
-    qDebug() << "Search completed.";
+    receive_tag_list(request_id, MPD_TAG_ARTIST);
 
-    while ((pair = mpd_recv_pair_tag(connection, MPD_TAG_ARTIST)) != NULL) {
-        list->push_back(pair->value);
-        mpd_return_pair(connection, pair);
-    }
+    qDebug() << "Search completed.";
 
 end:
-    mutex.unlock();
+    emit list_finished(request_id);
+    handle_errors();
 }
 
 void
-MPDClient::get_album_list(QStringList * list, QString artist)
+MPDClient::request_album_list(int request_id, QString artist)
 {
-    mpd_pair * pair;
-
-    list->clear();
-
-    qDebug() << "Fetching a list of albums by" << artist << "from MPD server.";
-
-    mutex.lock();
+    if (library) {
+        send_library_albums(request_id, artist);
+        return;
+    }
 
-    list->clear();
+    qDebug() << "Fetching a list of albums by" << artist << "from MPD server, request" << request_id;
 
-    if (!noidle()) {
-        qDebug() << "Unable to exit IDLE mode, aborting.";
+    if (!connection) {
+        qDebug() << "Not connected to MPD, aborting.";
         goto end;
     }
     if (!mpd_search_db_tags(connection, MPD_TAG_ALBUM)) {
@@ -359,58 +756,133 @@ MPDClient::get_album_list(QStringList * list, QString artist)
         goto end;
     }
 
+    receive_tag_list(request_id, MPD_TAG_ALBUM);
+
     qDebug() << "Search completed.";
 
-    while ((pair = mpd_recv_pair_tag(connection, MPD_TAG_ALBUM)) != NULL) {
-        list->push_back(pair->value);
-        mpd_return_pair(connection, pair);
+end:
+    emit list_finished(request_id);
+    handle_errors();
+}
+
+void
+MPDClient::search_album(const QString & artist, const QString & album)
+{
+    MPDCommandList list(connection);
+
+    /* Replace the queue and start playing, in a single round trip */
+    if (!list.begin() ||
+        !list.add("clear", mpd_send_clear(connection)) ||
+        !list.add("findadd", mpd_search_add_db_songs(connection, true) &&
+                  mpd_search_add_tag_constraint(connection, MPD_OPERATOR_DEFAULT, MPD_TAG_ARTIST, artist.toUtf8().data()) &&
+                  mpd_search_add_tag_constraint(connection, MPD_OPERATOR_DEFAULT, MPD_TAG_ALBUM, album.toUtf8().data()) &&
+                  mpd_search_commit(connection)) ||
+        !list.add("play", mpd_send_play(connection)) ||
+        !list.run()) {
+        qDebug() << "Unable to play album" << album << "by" << artist;
+        goto end;
     }
 
+    qDebug() << "Songs added successfully, now playing.";
+
 end:
-    mutex.unlock();
+    finish_list(list);
 }
 
 void
-MPDClient::play_album(QString album)
+MPDClient::play_album(QString artist, QString album)
 {
-    mpd_pair * pair;
-
-    qDebug() << "Playing album" << album;
+    MPDCommandList list(connection);
+    const LibraryAlbum * entry;
+    quint32 i;
+    int index;
 
-    mutex.lock();
+    qDebug() << "Playing album" << album << "by" << artist;
 
-    if (!noidle()) {
-        qDebug() << "Unable to exit IDLE mode, aborting.";
+    if (!connection) {
+        qDebug() << "Not connected to MPD, aborting.";
         goto end;
     }
-    if (!mpd_run_clear(connection)) {
-        qDebug() << "Unable to clear playlist, aborting.";
+
+    index = library ? library->find_album(library->find_artist(artist), album) : -1;
+    if (index == -1) {
+        qDebug() << "Album is not in the library index, searching for it.";
+        search_album(artist, album);
+        return;
+    }
+    entry = &library->album(index);
+
+    /* Queue the album's tracks in order, straight from the index */
+    if (!list.begin() || !list.add("clear", mpd_send_clear(connection))) {
         goto end;
     }
-    if (!mpd_search_add_db_songs(connection, true)) {
-        qDebug() << "Unable to initialize an MPD search, aborting.";
+    for (i = entry->first_track; i < entry->first_track + entry->track_count; i++) {
+        if (!list.add("add", mpd_send_add(connection, library->string(library->track(i).uri)))) {
+            goto end;
+        }
+    }
+    if (!list.add("play", mpd_send_play(connection)) || !list.run()) {
+        qDebug() << "Unable to play album" << album;
         goto end;
     }
-    if (!mpd_search_add_tag_constraint(connection, MPD_OPERATOR_DEFAULT, MPD_TAG_ALBUM, album.toUtf8().data())) {
-        qDebug() << "Unable to add tag constraint on MPD search, aborting.";
+
+end:
+    finish_list(list);
+}
+
+void
+MPDClient::play_uri(QString uri)
+{
+    MPDCommandList list(connection);
+    int id;
+
+    qDebug() << "Enqueueing and playing" << uri;
+
+    if (!connection) {
+        qDebug() << "Not connected to MPD, aborting.";
         goto end;
     }
-    if (!mpd_search_commit(connection)) {
-        qDebug() << "Unable to run an MPD search, aborting.";
+
+    /* Insert the song at the queue length as of the last status update,
+     * and play that position. If the queue has grown since, the song does
+     * not end up last, but it is still the one that plays. */
+    if (list.begin() &&
+        list.add("addid", mpd_send_add_id_to(connection, uri.toUtf8().data(), queue_length)) &&
+        list.add("play", mpd_send_play_pos(connection, queue_length)) &&
+        list.run()) {
         goto end;
     }
 
-    while ((pair = mpd_recv_pair_tag(connection, MPD_TAG_ALBUM)) != NULL) {
-        mpd_return_pair(connection, pair);
+    /* The queue has shrunk, so the position no longer exists. Append the
+     * song, and play it by its ID. */
+    if (!connected_and_ok()) {
+        goto end;
+    }
+    if ((id = mpd_run_add_id(connection, uri.toUtf8().data())) == -1 ||
+        !mpd_run_play_id(connection, id)) {
+        qDebug() << "Unable to enqueue and play" << uri;
+        goto end;
     }
 
-    if (!mpd_run_play(connection)) {
-        qDebug() << "Unable to start playing, aborting.";
+end:
+    finish_list(list);
+}
+
+void
+MPDClient::play_queue_pos(int pos)
+{
+    qDebug() << "Playing queue position" << pos;
+
+    if (!connection) {
+        qDebug() << "Not connected to MPD, aborting.";
         goto end;
     }
 
-    qDebug() << "Album added successfully, now playing.";
+    if (!mpd_run_play_pos(connection, pos)) {
+        qDebug() << "Unable to play queue position" << pos;
+        goto end;
+    }
 
 end:
-    mutex.unlock();
+    handle_errors();
 }
@@ -1,42 +1,121 @@
 #include <QObject>
 #include <QThread>
+#include <QTimer>
+#include <QSocketNotifier>
 #include <QtDebug>
-#include <QMutex>
 #include <QStringList>
 
 #include <mpd/client.h>
-#include <sys/select.h>
-#include <errno.h>
+#include <memory>
 
 #include "time.hpp"
+#include "library.hpp"
+#include "musicindex.hpp"
+#include "mpdcommandlist.hpp"
 
 
 #ifndef _GUI_MPDCLIENT_H_
 #define _GUI_MPDCLIENT_H_
 
 
-class MPDPlayerInfo : public QObject
+/**
+ * Reconnect backoff limits, in milliseconds.
+ */
+#define MPD_RECONNECT_MIN_MS 250
+#define MPD_RECONNECT_MAX_MS 8000
+
+/**
+ * Number of rows delivered per result signal when answering list queries.
+ */
+#define MPD_LIST_CHUNK_SIZE 100
+
+/**
+ * Number of upcoming queue entries announced for prefetching.
+ */
+#define MPD_PREFETCH_COUNT 3
+
+/**
+ * Idle events that affect the player info.
+ */
+#define MPD_IDLE_STATUS (MPD_IDLE_PLAYER | MPD_IDLE_MIXER | MPD_IDLE_QUEUE)
+
+/**
+ * Parts of the player info that were changed by an update, as passed with
+ * player_changed().
+ */
+#define MPD_CHANGED_SONG       (1 << 0)
+#define MPD_CHANGED_VOLUME     (1 << 1)
+#define MPD_CHANGED_ELAPSED    (1 << 2)
+#define MPD_CHANGED_CONNECTION (1 << 3)
+
+/**
+ * Song ID forcing the song tags to be fetched on the next update. MPD itself
+ * uses -1 when there is no current song.
+ */
+#define MPD_SONG_ID_UNKNOWN -2
+
+
+/**
+ * Tags of a song. Shared between player info snapshots, and only replaced
+ * when another song becomes current.
+ */
+struct MPDSongInfo
 {
-    Q_OBJECT
-
-public:
-    MPDPlayerInfo();
-
-    bool connected;
     QString uri;
     QString title;
     QString artist;
     QString album;
     QString year;
     QString track;
+};
+
+
+/**
+ * Immutable snapshot of the player state, as published by MPDClient.
+ *
+ * Each published snapshot has a higher version than the one before. The
+ * elapsed time is recorded together with the monotonic clock reading at
+ * which it was fetched, so that a snapshot remains valid while playback
+ * goes on and nothing needs to be published on every clock tick.
+ */
+struct MPDPlayerInfo
+{
+    MPDPlayerInfo();
+
+    /**
+     * Returns the elapsed time at the given monotonic clock reading.
+     */
+    Time elapsed_at(Time now) const;
+
+    quint64 version;
+    bool connected;
+    std::shared_ptr<const MPDSongInfo> song;
     mpd_state state;
     int volume;
     Time elapsed;
     Time duration;
+    Time stamp;
 };
 
 
-class MPDClient : public QThread
+/**
+ * MPD client living in its own thread.
+ *
+ * Two connections are kept to MPD. The notification connection is always
+ * parked in IDLE mode and watched by a socket notifier, while commands and
+ * queries are run on the command connection, so that they never have to
+ * leave IDLE mode first. Each connection is retried with an exponential
+ * backoff when lost, independently of the other.
+ *
+ * MPD closes connections that are not idle once its connection_timeout has
+ * passed, so the command connection is watched too, and reopened as soon
+ * as MPD closes it, before the next command needs it.
+ *
+ * The player state is published as immutable snapshots, which the GUI
+ * may read from any thread with snapshot(). The thread runs a Qt event
+ * loop, and when nothing happens, it does not wake up at all.
+ */
+class MPDClient : public QObject
 {
     Q_OBJECT
 
@@ -44,86 +123,274 @@ public:
     MPDClient();
 
     /**
-     * Connect to the MPD server.
+     * Move the client to its worker thread and start the event loop.
+     */
+    void start();
+
+    /**
+     * Connect the command connection to the MPD server.
      */
     bool connect();
 
     /**
-     * Disconnect from the MPD server.
+     * Disconnect the command connection from the MPD server.
      */
     void disconnect();
 
     /**
-     * Returns true if there is a valid MPD connection.
+     * Connect the notification connection and put it in IDLE mode.
      */
-    bool connected_and_ok();
+    bool connect_idle();
 
     /**
-     * Handle any MPD errors.
+     * Disconnect the notification connection.
      */
-    void handle_errors();
+    void disconnect_idle();
 
     /**
-     * Poll stdin and the MPD socket for events.
+     * Returns true if there is a valid MPD command connection.
+     */
+    bool connected_and_ok();
+
+    /**
+     * Handle any MPD errors on the command connection.
      *
-     * Returns true if any events occurred, false if not.
+     * Returns false if the connection was lost.
      */
-    bool has_idle_events(long timeout_ms);
+    bool handle_errors();
 
     /**
-     * Receive IDLE updates from MPD.
+     * Receive IDLE updates on the notification connection.
      */
     mpd_idle receive_idle_updates();
 
     /**
-     * Update status information from MPD.
+     * Update status information from MPD for the given idle events. Mixer
+     * events only update the volume, while player and queue events update
+     * the playback state; song metadata is only fetched when the current
+     * song has changed.
+     *
+     * The parts of the player info that changed are stored in `changed`,
+     * as a combination of MPD_CHANGED_* flags.
      */
-    bool update_player_info();
+    bool update_player_info(unsigned events, unsigned * changed);
 
     /**
-     * Tell MPD that we will chill out and wait for events.
+     * Returns the most recently published player state. Thread-safe.
+     */
+    std::shared_ptr<const MPDPlayerInfo> snapshot() const;
+
+    /**
+     * Tell MPD that we will chill out and wait for events on the
+     * notification connection.
      */
     bool idle();
 
+signals:
     /**
-     * Exit IDLE mode.
+     * A new player state snapshot has been published. `changed` tells which
+     * parts differ from the previous snapshot, as a combination of
+     * MPD_CHANGED_* flags, so that only those need to be redrawn. Several
+     * signals may be delivered for the same snapshot, if newer ones
+     * replaced it before the receiver got to it; each one carries the
+     * changes of its own publication.
      */
-    bool noidle();
+    void player_changed(unsigned changed);
 
     /**
-     * Increment the elapsed timer.
+     * Results of a list query, followed by list_finished(). Rows answered
+     * from the library index are delivered at once, as offsets into its
+     * string table, while rows fetched from MPD arrive in chunks of at most
+     * MPD_LIST_CHUNK_SIZE rows.
      */
-    bool progress_time();
+    void list_chunk(int request_id, QStringList rows);
+    void list_table(int request_id, QSharedPointer<const Library> library, QVector<quint32> offsets);
+    void list_finished(int request_id);
 
     /**
-     * Main loop.
+     * A new search index has been built for the library.
      */
-    void run();
+    void music_index_changed(QSharedPointer<const MusicIndex> index);
 
-signals:
-    void info_changed(MPDPlayerInfo * info);
-    void elapsed_changed(MPDPlayerInfo * info);
-    void uri_changed(MPDPlayerInfo * info);
+    /**
+     * The queue entries following the current song have changed. Carries
+     * the URI and album tag of each entry.
+     */
+    void upcoming_changed(QStringList uris, QStringList albums);
+
+    /**
+     * The queue has changed. Carries the new queue length, and the
+     * positions whose song changed since the previous notification. If
+     * `reset` is set, all positions must be considered changed.
+     */
+    void queue_changed(unsigned length, QVector<quint32> positions, bool reset);
+
+    /**
+     * Display text of queue entries, starting at position `start`.
+     */
+    void queue_page(unsigned start, QStringList rows);
 
 public slots:
-    void get_artist_list(QStringList * list);
-    void get_album_list(QStringList * list, QString artist);
-    void play_album(QString album);
+    /**
+     * Asynchronous library queries. Results are tagged with the request ID
+     * given by the caller.
+     */
+    void request_artist_list(int request_id);
+    void request_album_list(int request_id, QString artist);
+
+    /**
+     * Fetch the queue entries in the range [start, end), answered with
+     * queue_page().
+     */
+    void request_queue_page(unsigned start, unsigned end);
+
+    /**
+     * Playback actions.
+     *
+     * play_album() replaces the queue with the tracks of an artist's album,
+     * in a single command list. play_uri() appends a song to the queue and
+     * starts playing it, also in a single command list unless the queue
+     * has shrunk since the last status update. play_queue_pos() plays the
+     * queue entry at the given position.
+     */
+    void play_album(QString artist, QString album);
+    void play_uri(QString uri);
+    void play_queue_pos(int pos);
+
+private slots:
+    /**
+     * Set up timers in the worker thread and make the first connection.
+     */
+    void init();
+
+    /**
+     * Try to connect, and schedule a new attempt if that fails.
+     */
+    void reconnect();
+    void reconnect_idle();
+
+    /**
+     * Called by the socket notifier when MPD has sent events.
+     */
+    void socket_activated();
+
+    /**
+     * Called when the command connection becomes readable between
+     * commands, which only happens when MPD has closed it.
+     */
+    void command_socket_activated();
 
 private:
+    /**
+     * Fetch player info affected by the given idle events from MPD, and
+     * notify the GUI of the parts that changed.
+     */
+    void refresh(unsigned events);
+
+    /**
+     * Publish the working copy of the player info as a new snapshot, with
+     * the MPD_CHANGED_* flags of the parts that changed.
+     */
+    void publish(unsigned changed);
+
+    /**
+     * Fetch the tags of the current song.
+     */
+    bool update_song();
+
+    /**
+     * Fetch whatever was changed according to idle events.
+     */
+    void handle_events(unsigned events);
+
+    /**
+     * Handle errors after a command list. A list that was left open, as a
+     * command could not be queued, can not be recovered from, so the
+     * connection is dropped.
+     */
+    void finish_list(const MPDCommandList & list);
+
+    /**
+     * Drop a connection and schedule a reconnect.
+     */
+    void connection_lost();
+    void idle_connection_lost();
+
+    /**
+     * Receive tag values from a committed search, and emit them in chunks.
+     */
+    void receive_tag_list(int request_id, enum mpd_tag_type tag);
+
+    /**
+     * Announce the next queue entries if the queue or position changed.
+     */
+    void update_upcoming();
+
+    /**
+     * Tell the GUI which queue positions changed since it was last told,
+     * using MPD's brief queue change list.
+     */
+    void update_queue();
+
+    /**
+     * Replace the queue with all songs having the given artist and album
+     * tags, and play. Used when the album is not in the library index.
+     */
+    void search_album(const QString & artist, const QString & album);
+
+    /**
+     * Synchronize the library index with the MPD database.
+     */
+    void update_library();
+
+    /**
+     * Build a search index for the current library, and hand it out.
+     */
+    void update_music_index();
+
+    /**
+     * Answer list queries from the library index.
+     */
+    void send_library_artists(int request_id);
+    void send_library_albums(int request_id, const QString & artist);
+
+    QThread thread;
+
     struct mpd_connection * connection;
+    struct mpd_connection * idle_connection;
+
+    QSocketNotifier * notifier;
+    QSocketNotifier * command_notifier;
+    QTimer * reconnect_timer;
+    QTimer * idle_reconnect_timer;
+    int reconnect_delay;
+    int idle_reconnect_delay;
+
+    /* Working copy, only touched by the worker thread */
+    MPDPlayerInfo info;
 
-    MPDPlayerInfo * info;
+    /* Latest snapshot; only accessed through std::atomic_load/store */
+    std::shared_ptr<const MPDPlayerInfo> published;
 
-    Time timer;
+    /* Song ID the tags in `info` belong to; -1 if no song is current */
+    int song_id;
 
-    QString last_uri;
+    LibraryBuilder library_builder;
+    QSharedPointer<const Library> library;
+    QSharedPointer<const MusicIndex> music_index;
 
-    QMutex mutex;
+    /* Queue position as of the last status update, and as last announced */
+    int song_pos;
+    unsigned queue_version;
+    unsigned queue_length;
+    int upcoming_pos;
+    unsigned upcoming_version;
 
-    bool is_idle;
-    bool needs_update;
+    /* Queue version the GUI was last told about; 0 if never */
+    unsigned listed_queue_version;
 
+    /* Idle events received while the command connection was down */
+    unsigned pending_events;
 };
 
 #endif /* _GUI_MPDCLIENT_H_ */
@@ -0,0 +1,77 @@
+#include <QtDebug>
+
+#include "mpdcommandlist.hpp"
+
+
+MPDCommandList::MPDCommandList(struct mpd_connection * connection_)
+{
+    connection = connection_;
+    open = false;
+}
+
+bool
+MPDCommandList::begin()
+{
+    names.clear();
+
+    /* Ask for list_OK after each command, so that responses can be told
+     * apart and the failing command can be located */
+    open = mpd_command_list_begin(connection, true);
+    return open;
+}
+
+bool
+MPDCommandList::add(const char * name, bool sent)
+{
+    if (!sent) {
+        qDebug() << "Unable to queue MPD command" << names.size() + 1 << name
+                 << ":" << mpd_connection_get_error_message(connection);
+        return false;
+    }
+
+    names.push_back(name);
+    return true;
+}
+
+bool
+MPDCommandList::run()
+{
+    unsigned location;
+    int i;
+
+    open = false;
+
+    if (!mpd_command_list_end(connection)) {
+        return false;
+    }
+
+    /* Skip the response of each command up to its list_OK */
+    for (i = 0; i < names.size(); i++) {
+        if (!mpd_response_next(connection)) {
+            goto error;
+        }
+    }
+
+    if (mpd_response_finish(connection)) {
+        return true;
+    }
+
+error:
+    if (mpd_connection_get_error(connection) != MPD_ERROR_SERVER) {
+        return false;
+    }
+
+    location = mpd_connection_get_server_error_location(connection);
+    qDebug() << "MPD command" << location + 1 << "of" << names.size()
+             << (location < (unsigned) names.size() ? names[location].constData() : "?")
+             << "failed:" << mpd_connection_get_error_message(connection);
+    mpd_connection_clear_error(connection);
+
+    return false;
+}
+
+bool
+MPDCommandList::is_open() const
+{
+    return open;
+}
@@ -0,0 +1,62 @@
+#include <QByteArray>
+#include <QList>
+
+#include <mpd/client.h>
+
+
+#ifndef _GUI_MPDCOMMANDLIST_H_
+#define _GUI_MPDCOMMANDLIST_H_
+
+
+/**
+ * A batch of MPD commands sent as a single command list.
+ *
+ * Commands are queued with the mpd_send_* functions between begin() and
+ * run(), and each one is registered with add() under a name used for error
+ * reporting. The whole batch costs one round trip. MPD stops at the first
+ * failing command, and run() reports which one it was.
+ *
+ * If a command can not be queued, the list is left open. Ending it would
+ * run the commands queued so far, so the connection must be dropped
+ * instead; is_open() tells when that is the case.
+ *
+ * Commands that return data, such as searches, may be part of the batch;
+ * their responses are discarded.
+ */
+class MPDCommandList
+{
+public:
+    MPDCommandList(struct mpd_connection * connection_);
+
+    /**
+     * Start the command list. The connection must not be in IDLE mode.
+     */
+    bool begin();
+
+    /**
+     * Register a queued command. `sent` is the return value of the send
+     * function, so that calls can be chained; returns the same value.
+     */
+    bool add(const char * name, bool sent);
+
+    /**
+     * Send the command list and read the reply. Returns false if the list
+     * could not be sent, or if any command failed. Server errors are
+     * logged with the failing command and cleared, while connection errors
+     * are left for the caller to handle.
+     */
+    bool run();
+
+    /**
+     * Returns true if the list was begun, but not run.
+     */
+    bool is_open() const;
+
+private:
+    struct mpd_connection * connection;
+    QList<QByteArray> names;
+    bool open;
+};
+
+
+#endif /* _GUI_MPDCOMMANDLIST_H_ */
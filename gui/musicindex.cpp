@@ -0,0 +1,345 @@
+#include <QList>
+#include <QtDebug>
+#include <QElapsedTimer>
+
+#include <algorithm>
+#include <string.h>
+
+#include "musicindex.hpp"
+
+
+/**
+ * A folded name together with its entry, for sorting.
+ */
+struct MusicIndexName
+{
+    const char * name;
+    quint32 entry;
+};
+
+static bool
+name_less(const MusicIndexName & a, const MusicIndexName & b)
+{
+    return strcmp(a.name, b.name) < 0;
+}
+
+/**
+ * Posting list range, for ordering lists by length.
+ */
+struct MusicIndexRange
+{
+    const quint32 * begin;
+    const quint32 * end;
+};
+
+static bool
+range_shorter(const MusicIndexRange & a, const MusicIndexRange & b)
+{
+    return (a.end - a.begin) < (b.end - b.begin);
+}
+
+
+MusicIndex::MusicIndex(QSharedPointer<const Library> library_)
+{
+    QVector<quint64> pairs;
+    QVector<MusicIndexName> order;
+    QByteArray folded;
+    QElapsedTimer timer;
+    quint32 entry;
+    quint32 count;
+    quint32 i;
+    int j;
+
+    timer.start();
+
+    library = library_;
+    album_base = library->artist_count();
+    track_base = album_base + library->album_count();
+    count = track_base + library->track_count();
+
+    /* Fold all names into one buffer */
+    name_offsets.reserve(count);
+    for (entry = 0; entry < count; entry++) {
+        if (entry < album_base) {
+            folded = fold(library->qstring(library->artist(entry).name));
+        } else if (entry < track_base) {
+            folded = fold(library->qstring(library->album(entry - album_base).name));
+        } else {
+            folded = fold(library->qstring(library->track(entry - track_base).title));
+        }
+        name_offsets.push_back(names.size());
+        names.append(folded);
+        names.append('\0');
+    }
+
+    /* Collect the trigrams within each word */
+    for (entry = 0; entry < count; entry++) {
+        const char * name = folded_name(entry);
+        for (j = 0; name[j] && name[j + 1] && name[j + 2]; j++) {
+            if (name[j] != ' ' && name[j + 1] != ' ' && name[j + 2] != ' ') {
+                pairs.push_back(((quint64)trigram(name + j) << 32) | entry);
+            }
+        }
+    }
+
+    std::sort(pairs.begin(), pairs.end());
+    pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+
+    /* Lay out the posting lists back to back */
+    gram_postings.reserve(pairs.size());
+    for (j = 0; j < pairs.size(); j++) {
+        if (grams.isEmpty() || grams.last() != (quint32)(pairs[j] >> 32)) {
+            grams.push_back(pairs[j] >> 32);
+            gram_starts.push_back(gram_postings.size());
+        }
+        gram_postings.push_back((quint32)pairs[j]);
+    }
+    gram_starts.push_back(gram_postings.size());
+
+    /* Sort the entries by name for prefix searches */
+    order.resize(count);
+    for (i = 0; i < count; i++) {
+        order[i].name = folded_name(i);
+        order[i].entry = i;
+    }
+    std::stable_sort(order.begin(), order.end(), name_less);
+
+    sorted.reserve(count);
+    for (i = 0; i < count; i++) {
+        sorted.push_back(order[i].entry);
+    }
+
+    qDebug() << "Built music search index with" << count << "names and"
+             << grams.size() << "trigrams in" << timer.elapsed() << "ms.";
+}
+
+QByteArray
+MusicIndex::fold(const QString & text)
+{
+    QString decomposed;
+    QByteArray result;
+    const char * spelled;
+    bool space;
+    ushort c;
+    int i;
+
+    /* Split accented letters into base letters and combining marks */
+    decomposed = text.normalized(QString::NormalizationForm_KD).toLower();
+
+    result.reserve(decomposed.size());
+    space = true;
+
+    for (i = 0; i < decomposed.size(); i++) {
+        c = decomposed[i].unicode();
+
+        /* Letters that do not decompose */
+        switch (c) {
+            case 0x00e6: spelled = "ae"; break;  /* æ */
+            case 0x00f8: spelled = "o"; break;   /* ø */
+            case 0x00df: spelled = "ss"; break;  /* ß */
+            case 0x00fe: spelled = "th"; break;  /* þ */
+            case 0x00f0: spelled = "d"; break;   /* ð */
+            case 0x0111: spelled = "d"; break;   /* đ */
+            case 0x0142: spelled = "l"; break;   /* ł */
+            case 0x0153: spelled = "oe"; break;  /* œ */
+            default: spelled = NULL; break;
+        }
+
+        if (spelled) {
+            result.append(spelled);
+            space = false;
+        } else if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9')) {
+            result.append((char)c);
+            space = false;
+        } else if (decomposed[i].category() == QChar::Mark_NonSpacing) {
+            continue;
+        } else if (!space) {
+            result.append(' ');
+            space = true;
+        }
+    }
+
+    if (result.endsWith(' ')) {
+        result.chop(1);
+    }
+
+    return result;
+}
+
+quint32
+MusicIndex::trigram(const char * str)
+{
+    return ((quint32)(uchar)str[0] << 16) | ((quint32)(uchar)str[1] << 8) | (uchar)str[2];
+}
+
+const char *
+MusicIndex::folded_name(quint32 entry) const
+{
+    return names.constData() + name_offsets[entry];
+}
+
+bool
+MusicIndex::postings(quint32 gram, const quint32 ** begin, const quint32 ** end) const
+{
+    const quint32 * it;
+    int i;
+
+    it = std::lower_bound(grams.constBegin(), grams.constEnd(), gram);
+    if (it == grams.constEnd() || *it != gram) {
+        return false;
+    }
+
+    i = it - grams.constBegin();
+    *begin = gram_postings.constData() + gram_starts[i];
+    *end = gram_postings.constData() + gram_starts[i + 1];
+
+    return true;
+}
+
+bool
+MusicIndex::matches(quint32 entry, const QList<QByteArray> & words) const
+{
+    const char * name;
+    int i;
+
+    name = folded_name(entry);
+
+    for (i = 0; i < words.size(); i++) {
+        if (!strstr(name, words[i].constData())) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void
+MusicIndex::search_prefix(const QByteArray & prefix, int limit, QVector<quint32> & hits) const
+{
+    int low = 0;
+    int high = sorted.size();
+    int mid;
+
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        if (strncmp(folded_name(sorted[mid]), prefix.constData(), prefix.size()) < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    while (low < sorted.size() && hits.size() < limit &&
+           strncmp(folded_name(sorted[low]), prefix.constData(), prefix.size()) == 0) {
+        hits.push_back(sorted[low]);
+        low++;
+    }
+
+    std::sort(hits.begin(), hits.end());
+}
+
+QVector<quint32>
+MusicIndex::search(const QString & term, int limit) const
+{
+    QVector<MusicIndexRange> ranges;
+    QVector<quint32> candidates;
+    QVector<quint32> hits;
+    QList<QByteArray> words;
+    MusicIndexRange range;
+    QByteArray query;
+    const quint32 * p;
+    int kept;
+    int i;
+    int j;
+
+    query = fold(term);
+    if (query.isEmpty()) {
+        return hits;
+    }
+
+    words = query.split(' ');
+
+    for (i = 0; i < words.size(); i++) {
+        for (j = 0; j + 3 <= words[i].size(); j++) {
+            if (!postings(trigram(words[i].constData() + j), &range.begin, &range.end)) {
+                return hits;
+            }
+            ranges.push_back(range);
+        }
+    }
+
+    /* Too short for trigrams */
+    if (ranges.isEmpty()) {
+        search_prefix(query, limit, hits);
+        return hits;
+    }
+
+    /* Start from the rarest trigram, and keep only candidates that are in
+     * every other posting list */
+    std::sort(ranges.begin(), ranges.end(), range_shorter);
+
+    for (p = ranges[0].begin; p != ranges[0].end; p++) {
+        candidates.push_back(*p);
+    }
+
+    for (i = 1; i < ranges.size() && !candidates.isEmpty(); i++) {
+        kept = 0;
+        for (j = 0; j < candidates.size(); j++) {
+            if (std::binary_search(ranges[i].begin, ranges[i].end, candidates[j])) {
+                candidates[kept++] = candidates[j];
+            }
+        }
+        candidates.resize(kept);
+    }
+
+    /* Trigrams may occur out of order, and short words are not indexed */
+    for (i = 0; i < candidates.size() && hits.size() < limit; i++) {
+        if (matches(candidates[i], words)) {
+            hits.push_back(candidates[i]);
+        }
+    }
+
+    return hits;
+}
+
+MusicIndex::Kind
+MusicIndex::kind(quint32 entry) const
+{
+    if (entry < album_base) {
+        return KIND_ARTIST;
+    } else if (entry < track_base) {
+        return KIND_ALBUM;
+    }
+    return KIND_TRACK;
+}
+
+quint32
+MusicIndex::library_index(quint32 entry) const
+{
+    if (entry < album_base) {
+        return entry;
+    } else if (entry < track_base) {
+        return entry - album_base;
+    }
+    return entry - track_base;
+}
+
+QString
+MusicIndex::text(quint32 entry) const
+{
+    const LibraryAlbum * album;
+
+    switch (kind(entry)) {
+        case KIND_ARTIST:
+            return library->qstring(library->artist(entry).name);
+        case KIND_ALBUM:
+            album = &library->album(entry - album_base);
+            break;
+        default:
+            album = &library->album(library->track(entry - track_base).album);
+            return library->qstring(library->track(entry - track_base).title) + " – " +
+                   library->qstring(library->artist(album->artist).name);
+    }
+
+    return library->qstring(album->name) + " – " + library->qstring(library->artist(album->artist).name);
+}
@@ -0,0 +1,104 @@
+#include <QByteArray>
+#include <QMetaType>
+#include <QSharedPointer>
+#include <QString>
+#include <QVector>
+
+#include "library.hpp"
+
+
+#ifndef _GUI_MUSICINDEX_H_
+#define _GUI_MUSICINDEX_H_
+
+
+/**
+ * Maximum number of hits returned by a search.
+ */
+#define MUSIC_SEARCH_LIMIT 100
+
+
+/**
+ * Type-ahead search index over the artists, albums and track titles of a
+ * library snapshot.
+ *
+ * All names are folded to lower case ASCII letters, digits and single
+ * spaces: accents are stripped, and letters such as Æ, Ø and ß are spelled
+ * out, so that "blå" is found as "bla" and "Mötley" as "motley".
+ *
+ * Every three-letter sequence within a word of a folded name is indexed,
+ * with a sorted posting list of the names containing it. A search looks up
+ * the trigrams of the query words, intersects their posting lists starting
+ * with the shortest, and then checks the few remaining candidates. Queries
+ * too short for trigrams are answered with a binary search for names that
+ * start with the query.
+ *
+ * The index is immutable once built, and may be shared between threads.
+ */
+class MusicIndex
+{
+public:
+    enum Kind {
+        KIND_ARTIST,
+        KIND_ALBUM,
+        KIND_TRACK
+    };
+
+    /**
+     * Build the index. This takes a while for large libraries, and should
+     * be done outside the GUI thread.
+     */
+    MusicIndex(QSharedPointer<const Library> library_);
+
+    /**
+     * Returns up to `limit` entries matching all words of the term. Artists
+     * come first, then albums, then tracks.
+     */
+    QVector<quint32> search(const QString & term, int limit = MUSIC_SEARCH_LIMIT) const;
+
+    /**
+     * Describe an entry returned by search().
+     */
+    Kind kind(quint32 entry) const;
+    quint32 library_index(quint32 entry) const;
+    QString text(quint32 entry) const;
+
+    QSharedPointer<const Library> library;
+
+    /**
+     * Fold text for matching, as described above.
+     */
+    static QByteArray fold(const QString & text);
+
+private:
+    Q_DISABLE_COPY(MusicIndex)
+
+    const char * folded_name(quint32 entry) const;
+    bool matches(quint32 entry, const QList<QByteArray> & words) const;
+    void search_prefix(const QByteArray & prefix, int limit, QVector<quint32> & hits) const;
+
+    /* Trigram lookup; returns false if the trigram does not occur */
+    bool postings(quint32 gram, const quint32 ** begin, const quint32 ** end) const;
+
+    static quint32 trigram(const char * str);
+
+    /* Folded names of all entries, NUL-terminated, in entry order */
+    QByteArray names;
+    QVector<quint32> name_offsets;
+
+    /* Entries sorted by folded name, for prefix searches */
+    QVector<quint32> sorted;
+
+    /* Sorted trigrams, and their posting lists */
+    QVector<quint32> grams;
+    QVector<quint32> gram_starts;
+    QVector<quint32> gram_postings;
+
+    quint32 album_base;
+    quint32 track_base;
+};
+
+
+Q_DECLARE_METATYPE(QSharedPointer<const MusicIndex>)
+
+
+#endif /* _GUI_MUSICINDEX_H_ */
@@ -9,37 +9,76 @@ MusicScreen::MusicScreen()
 
     /* Set up MPD client */
     mpd_client = new MPDClient();
+    last_request_id = 0;
+    artist_request_id = 0;
+    album_request_id = 0;
 
     /* Set up player screen */
-    player_screen = new PlayerScreen;
+    player_screen = new PlayerScreen(mpd_client);
     artist_screen = new ListScreen;
     album_screen = new ListScreen;
+    search_screen = new MusicSearchScreen;
+    queue_screen = new QueueScreen;
     setTabPosition(QTabWidget::South);
     addTab(player_screen, "Now playing");
+    addTab(search_screen, "Search");
+    addTab(queue_screen, "Queue");
 
     /* Connect MPD info change to GUI draw */
-    QObject::connect(mpd_client, &MPDClient::info_changed,
-                     player_screen, &PlayerScreen::info_changed);
-    QObject::connect(mpd_client, &MPDClient::elapsed_changed,
-                     player_screen, &PlayerScreen::elapsed_changed);
-    QObject::connect(mpd_client, &MPDClient::uri_changed,
-                     player_screen, &PlayerScreen::uri_changed);
+    QObject::connect(mpd_client, &MPDClient::player_changed,
+                     player_screen, &PlayerScreen::player_changed);
+    QObject::connect(mpd_client, &MPDClient::upcoming_changed,
+                     player_screen, &PlayerScreen::upcoming_changed);
 
     /* Album and artist list interaction */
     QObject::connect(player_screen->albumart_widget, &AlbumArtWidget::clicked,
                      this, &MusicScreen::get_artist_list_slot);
-    QObject::connect(artist_screen, &ListScreen::itemClicked,
+    QObject::connect(artist_screen, &ListScreen::selected,
                      this, &MusicScreen::get_album_list_slot);
-    QObject::connect(album_screen, &ListScreen::itemClicked,
+    QObject::connect(album_screen, &ListScreen::selected,
                      this, &MusicScreen::play_album_slot);
 
+    /* Music search */
+    QObject::connect(mpd_client, &MPDClient::music_index_changed,
+                     search_screen, &MusicSearchScreen::set_index);
+    QObject::connect(search_screen, &MusicSearchScreen::artist_selected,
+                     this, &MusicScreen::show_albums);
+    QObject::connect(search_screen, &MusicSearchScreen::album_selected,
+                     this, &MusicScreen::start_album);
+    QObject::connect(search_screen, &MusicSearchScreen::track_selected,
+                     this, &MusicScreen::start_track);
+    QObject::connect(search_screen->keyboard, &SearchScreen::cancel,
+                     this, &MusicScreen::show_player);
+
+    /* Queue view, fetched page by page as it is scrolled */
+    QObject::connect(mpd_client, &MPDClient::queue_changed,
+                     queue_screen->queue, &QueueModel::queue_changed);
+    QObject::connect(mpd_client, &MPDClient::queue_page,
+                     queue_screen->queue, &QueueModel::queue_page);
+    QObject::connect(queue_screen->queue, &QueueModel::page_requested,
+                     mpd_client, &MPDClient::request_queue_page);
+    QObject::connect(queue_screen, &QueueScreen::selected,
+                     this, &MusicScreen::start_queue_pos);
+
     /* Remote calls to MPD thread */
-    QObject::connect(this, &MusicScreen::get_artist_list,
-                     mpd_client, &MPDClient::get_artist_list);
-    QObject::connect(this, &MusicScreen::get_album_list,
-                     mpd_client, &MPDClient::get_album_list);
+    QObject::connect(this, &MusicScreen::request_artist_list,
+                     mpd_client, &MPDClient::request_artist_list);
+    QObject::connect(this, &MusicScreen::request_album_list,
+                     mpd_client, &MPDClient::request_album_list);
     QObject::connect(this, &MusicScreen::play_album,
                      mpd_client, &MPDClient::play_album);
+    QObject::connect(this, &MusicScreen::play_uri,
+                     mpd_client, &MPDClient::play_uri);
+    QObject::connect(this, &MusicScreen::play_queue_pos,
+                     mpd_client, &MPDClient::play_queue_pos);
+
+    /* List query results from MPD thread */
+    QObject::connect(mpd_client, &MPDClient::list_chunk,
+                     this, &MusicScreen::list_chunk);
+    QObject::connect(mpd_client, &MPDClient::list_table,
+                     this, &MusicScreen::list_table);
+    QObject::connect(mpd_client, &MPDClient::list_finished,
+                     this, &MusicScreen::list_finished);
 
     /* Start MPD client late to avoid updates before GUI is ready */
     mpd_client->start();
@@ -48,47 +87,105 @@ MusicScreen::MusicScreen()
 void
 MusicScreen::get_artist_list_slot()
 {
-    QStringList artist_list;
-
-    emit get_artist_list(&artist_list);
-
-    artist_screen->clear();
-    artist_screen->addItems(artist_list);
+    artist_request_id = ++last_request_id;
+    artist_screen->rows->clear();
 
     if (indexOf(artist_screen) == -1) {
         addTab(artist_screen, "Artists");
     }
-    setCurrentIndex(1);
+    setCurrentWidget(artist_screen);
+
+    emit request_artist_list(artist_request_id);
 }
 
 void
-MusicScreen::get_album_list_slot(QListWidgetItem * item)
+MusicScreen::get_album_list_slot(int row, QString artist)
 {
-    QStringList album_list;
-    QString artist;
-
-    artist = item->text();
+    Q_UNUSED(row);
 
-    emit get_album_list(&album_list, artist);
+    show_albums(artist);
+}
 
-    album_screen->clear();
-    album_screen->addItems(album_list);
+void
+MusicScreen::show_albums(QString artist)
+{
+    album_request_id = ++last_request_id;
+    album_artist = artist;
+    album_screen->rows->clear();
 
     if (indexOf(album_screen) == -1) {
         addTab(album_screen, "Albums");
     }
-    setTabText(2, "Albums by " + artist);
-    setCurrentIndex(2);
+    setTabText(indexOf(album_screen), "Albums by " + artist);
+    setCurrentWidget(album_screen);
+
+    emit request_album_list(album_request_id, artist);
 }
 
 void
-MusicScreen::play_album_slot(QListWidgetItem * item)
+MusicScreen::list_chunk(int request_id, QStringList rows)
 {
-    QString album;
+    if (request_id == artist_request_id) {
+        artist_screen->rows->append(rows);
+    } else if (request_id == album_request_id) {
+        album_screen->rows->append(rows);
+    }
+}
 
-    album = item->text();
+void
+MusicScreen::list_table(int request_id, QSharedPointer<const Library> library, QVector<quint32> offsets)
+{
+    if (request_id == artist_request_id) {
+        artist_screen->rows->set_library_strings(library, offsets);
+    } else if (request_id == album_request_id) {
+        album_screen->rows->set_library_strings(library, offsets);
+    }
+}
 
-    emit play_album(album);
+void
+MusicScreen::list_finished(int request_id)
+{
+    if (request_id == artist_request_id) {
+        artist_request_id = 0;
+    } else if (request_id == album_request_id) {
+        album_request_id = 0;
+    }
+}
 
-    setCurrentIndex(0);
+void
+MusicScreen::play_album_slot(int row, QString album)
+{
+    Q_UNUSED(row);
+
+    start_album(album_artist, album);
+}
+
+void
+MusicScreen::start_album(QString artist, QString album)
+{
+    emit play_album(artist, album);
+
+    show_player();
+}
+
+void
+MusicScreen::start_track(QString uri)
+{
+    emit play_uri(uri);
+
+    show_player();
+}
+
+void
+MusicScreen::start_queue_pos(int pos)
+{
+    emit play_queue_pos(pos);
+
+    show_player();
+}
+
+void
+MusicScreen::show_player()
+{
+    setCurrentWidget(player_screen);
 }
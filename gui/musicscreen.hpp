@@ -6,11 +6,14 @@
 #include <QStringList>
 #include <QString>
 #include <QTabWidget>
-#include <QListWidgetItem>
+#include <QSharedPointer>
+#include <QVector>
 
 #include "mpdclient.hpp"
 #include "playerscreen.hpp"
 #include "listscreen.hpp"
+#include "musicsearchscreen.hpp"
+#include "queuescreen.hpp"
 #include "albumartwidget.hpp"
 
 
@@ -26,21 +29,41 @@ public:
     MusicScreen();
 
 signals:
-    void get_artist_list(QStringList * list);
-    void get_album_list(QStringList * list, QString artist);
-    void play_album(QString album);
+    void request_artist_list(int request_id);
+    void request_album_list(int request_id, QString artist);
+    void play_album(QString artist, QString album);
+    void play_uri(QString uri);
+    void play_queue_pos(int pos);
 
 public slots:
     void get_artist_list_slot();
-    void get_album_list_slot(QListWidgetItem * item);
-    void play_album_slot(QListWidgetItem * item);
+    void get_album_list_slot(int row, QString artist);
+    void play_album_slot(int row, QString album);
+    void show_albums(QString artist);
+    void start_album(QString artist, QString album);
+    void start_track(QString uri);
+    void start_queue_pos(int pos);
+    void show_player();
+    void list_chunk(int request_id, QStringList rows);
+    void list_table(int request_id, QSharedPointer<const Library> library, QVector<quint32> offsets);
+    void list_finished(int request_id);
 
 private:
     PlayerScreen * player_screen;
     ListScreen * artist_screen;
     ListScreen * album_screen;
+    MusicSearchScreen * search_screen;
+    QueueScreen * queue_screen;
 
     MPDClient * mpd_client;
+
+    /* Artist whose albums are listed on the album screen */
+    QString album_artist;
+
+    /* Outstanding list requests; results for older requests are dropped */
+    int last_request_id;
+    int artist_request_id;
+    int album_request_id;
 };
 
 
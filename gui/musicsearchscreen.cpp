@@ -0,0 +1,86 @@
+#include <QElapsedTimer>
+#include <QtDebug>
+
+#include "musicsearchscreen.hpp"
+
+
+MusicSearchScreen::MusicSearchScreen()
+{
+    setObjectName("music_search_screen");
+
+    keyboard = new SearchScreen();
+    results = new ListScreen();
+
+    layout = new QVBoxLayout(this);
+    layout->addWidget(results, 1);
+    layout->addWidget(keyboard, 2);
+
+    QObject::connect(keyboard, &SearchScreen::term_changed,
+                     this, &MusicSearchScreen::term_changed);
+    QObject::connect(results, &ListScreen::selected,
+                     this, &MusicSearchScreen::result_selected);
+}
+
+void
+MusicSearchScreen::set_index(QSharedPointer<const MusicIndex> index_)
+{
+    index = index_;
+    term_changed(last_term);
+}
+
+void
+MusicSearchScreen::term_changed(QString term)
+{
+    QStringList rows;
+    QElapsedTimer timer;
+    int i;
+
+    last_term = term;
+
+    if (!index) {
+        return;
+    }
+
+    timer.start();
+
+    hits = index->search(term);
+    for (i = 0; i < hits.size(); i++) {
+        rows.push_back(index->text(hits[i]));
+    }
+
+    results->rows->clear();
+    results->rows->append(rows);
+
+    qDebug() << "Music search for" << term << "found" << hits.size() << "hits in" << timer.elapsed() << "ms.";
+}
+
+void
+MusicSearchScreen::result_selected(int row, QString text)
+{
+    const Library * library;
+    quint32 entry;
+    quint32 i;
+
+    Q_UNUSED(text);
+
+    if (!index || row < 0 || row >= hits.size()) {
+        return;
+    }
+
+    entry = hits[row];
+    i = index->library_index(entry);
+    library = index->library.data();
+
+    switch (index->kind(entry)) {
+        case MusicIndex::KIND_ARTIST:
+            emit artist_selected(library->qstring(library->artist(i).name));
+            break;
+        case MusicIndex::KIND_ALBUM:
+            emit album_selected(library->qstring(library->artist(library->album(i).artist).name),
+                                library->qstring(library->album(i).name));
+            break;
+        case MusicIndex::KIND_TRACK:
+            emit track_selected(library->qstring(library->track(i).uri));
+            break;
+    }
+}
@@ -0,0 +1,51 @@
+#include <QSharedPointer>
+#include <QString>
+#include <QVBoxLayout>
+#include <QVector>
+#include <QWidget>
+
+#include "listscreen.hpp"
+#include "musicindex.hpp"
+#include "searchscreen.hpp"
+
+
+#ifndef _GUI_MUSICSEARCHSCREEN_H_
+#define _GUI_MUSICSEARCHSCREEN_H_
+
+
+/**
+ * On-screen keyboard with a list of matching artists, albums and tracks,
+ * updated on every key press.
+ */
+class MusicSearchScreen : public QWidget
+{
+    Q_OBJECT
+
+public:
+    MusicSearchScreen();
+
+    SearchScreen * keyboard;
+    ListScreen * results;
+
+signals:
+    void artist_selected(QString artist);
+    void album_selected(QString artist, QString album);
+    void track_selected(QString uri);
+
+public slots:
+    void set_index(QSharedPointer<const MusicIndex> index_);
+
+private slots:
+    void term_changed(QString term);
+    void result_selected(int row, QString text);
+
+private:
+    QVBoxLayout * layout;
+
+    QSharedPointer<const MusicIndex> index;
+    QVector<quint32> hits;
+    QString last_term;
+};
+
+
+#endif /* _GUI_MUSICSEARCHSCREEN_H_ */
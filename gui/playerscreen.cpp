@@ -1,11 +1,14 @@
+#include <stdio.h>
+
 #include "playerscreen.hpp"
-#include "tagfile.hpp"
 
 
-PlayerScreen::PlayerScreen()
+PlayerScreen::PlayerScreen(MPDClient * mpd_client_)
 {
     setObjectName("player_screen");
 
+    mpd_client = mpd_client_;
+
     /* Set up title widget */
     title = new QLabel;
     title->setObjectName("music_title");
@@ -40,6 +43,16 @@ PlayerScreen::PlayerScreen()
     volume->setMinimum(0);
     volume->setMaximum(100);
 
+    /* Redraw the elapsed clock while playing, once per second */
+    shown_seconds = -1;
+    shown_duration = -1;
+    shown_state = MPD_STATE_UNKNOWN;
+    elapsed_timer = new QTimer(this);
+    elapsed_timer->setSingleShot(true);
+    elapsed_timer->setTimerType(Qt::PreciseTimer);
+    QObject::connect(elapsed_timer, &QTimer::timeout,
+                     this, &PlayerScreen::draw_elapsed);
+
     /* Set up albumart widget */
     albumart_widget = new AlbumArtWidget;
     albumart_widget->setObjectName("music_album_art");
@@ -47,6 +60,15 @@ PlayerScreen::PlayerScreen()
     /* Draw blank albumart */
     albumart_widget->reset();
 
+    /* Set up background albumart loader */
+    albumart_serial = 0;
+    albumart_loader = new AlbumArtLoader();
+    QObject::connect(albumart_loader, &AlbumArtLoader::loaded,
+                     this, &PlayerScreen::albumart_loaded);
+    QObject::connect(albumart_loader, &AlbumArtLoader::prefetched,
+                     this, &PlayerScreen::albumart_prefetched);
+    albumart_loader->start();
+
     /* Set up layouts */
     layout = new QVBoxLayout(this);
     info_layout = new QHBoxLayout();
@@ -77,57 +99,178 @@ PlayerScreen::PlayerScreen()
 }
 
 void
-PlayerScreen::info_changed(MPDPlayerInfo * info)
+PlayerScreen::player_changed(unsigned changed)
+{
+    std::shared_ptr<const MPDPlayerInfo> info;
+
+    /* Always draw the latest snapshot. A notification may arrive after a
+     * newer snapshot was published, whose own notification then follows,
+     * so every part flagged by some notification gets drawn. */
+    info = mpd_client->snapshot();
+
+    if (changed & MPD_CHANGED_SONG) {
+        draw_song(*info->song);
+        if (!drawn || info->song->uri != drawn->song->uri) {
+            draw_albumart(*info->song);
+        }
+    }
+    if (changed & MPD_CHANGED_VOLUME) {
+        volume->setValue(info->volume);
+    }
+
+    drawn = info;
+
+    if (changed & MPD_CHANGED_ELAPSED) {
+        draw_elapsed();
+    }
+}
+
+void
+PlayerScreen::draw_song(const MPDSongInfo & song)
 {
-    title->setText(info->title);
-    artist->setText(info->artist);
-    album->setText(info->album);
-    year->setText(info->year.left(4));
-    if (info->track.size() == 0) {
-        track->setText(info->track);
+    title->setText(song.title);
+    artist->setText(song.artist);
+    album->setText(song.album);
+    year->setText(song.year.left(4));
+    if (song.track.size() == 0) {
+        track->setText(song.track);
     } else {
-        track->setText("Track " + info->track);
+        track->setText("Track " + song.track);
     }
-    volume->setValue(info->volume);
 }
 
 void
-PlayerScreen::elapsed_changed(MPDPlayerInfo * info)
+PlayerScreen::draw_elapsed()
 {
-    QString state_text;
+    const char * state_text;
+    char text[2 * TIME_STRING_SIZE + 16];
+    char position_text[TIME_STRING_SIZE];
+    char duration_text[TIME_STRING_SIZE];
+    Time position;
+    qint64 seconds;
+    qint64 duration;
 
-    if (info->state == MPD_STATE_PAUSE) {
+    position = drawn->elapsed_at(Time::now());
+    seconds = position.get_total_seconds();
+    duration = drawn->duration.get_total_seconds();
+    if (drawn->state != MPD_STATE_PLAY && drawn->state != MPD_STATE_PAUSE) {
+        seconds = 0;
+        duration = 1;
+    }
+
+    /* Wake up again right when the next second starts */
+    if (drawn->state == MPD_STATE_PLAY) {
+        elapsed_timer->start(1000 - position.get_total_ms() % 1000);
+    } else {
+        elapsed_timer->stop();
+    }
+
+    /* Only touch the widgets when what they show has changed */
+    if (seconds == shown_seconds && duration == shown_duration && drawn->state == shown_state) {
+        return;
+    }
+
+    if (drawn->state == MPD_STATE_PAUSE) {
         state_text = "‖";
-    } else if (info->state == MPD_STATE_PLAY) {
+    } else if (drawn->state == MPD_STATE_PLAY) {
         state_text = "▶";
-    } else if (info->state == MPD_STATE_STOP) {
+    } else if (drawn->state == MPD_STATE_STOP) {
         state_text = "■";
     } else {
         state_text = "?";
     }
 
-    if (info->state == MPD_STATE_PLAY || info->state == MPD_STATE_PAUSE) {
-        elapsed->setText(state_text + " " + info->elapsed.get_short_string() + " / " + info->duration.get_short_string());
-        progress->setMaximum(info->duration.get_total_seconds());
+    if (drawn->state == MPD_STATE_PLAY || drawn->state == MPD_STATE_PAUSE) {
+        position.format(position_text);
+        drawn->duration.format(duration_text);
+        snprintf(text, sizeof(text), "%s %s / %s", state_text, position_text, duration_text);
     } else {
-        elapsed->setText(state_text + " Stopped");
-        progress->setMaximum(1);
+        snprintf(text, sizeof(text), "%s Stopped", state_text);
     }
-    progress->setMinimum(0);
-    progress->setValue(info->elapsed.get_total_seconds());
+    elapsed->setText(QString::fromUtf8(text));
+
+    if (duration != shown_duration) {
+        progress->setRange(0, duration);
+    }
+    progress->setValue(seconds);
+
+    shown_seconds = seconds;
+    shown_duration = duration;
+    shown_state = drawn->state;
 }
 
 void
-PlayerScreen::uri_changed(MPDPlayerInfo * info)
+PlayerScreen::draw_albumart(const MPDSongInfo & song)
 {
-    QPixmap source;
-    TagFile f("/var/lib/mpd/music/" + info->uri);
+    QString key;
 
-    if (!f.get_album_art(&source)) {
-        albumart_widget->reset();
+    key = AlbumArtCache::key(song.uri, song.album);
+
+    if (albumart_cache.find_memory(key, &albumart)) {
+        albumart_serial = 0;
+        if (albumart.isNull()) {
+            albumart_widget->reset();
+        } else {
+            albumart_widget->setPixmap(albumart);
+        }
+        return;
+    }
+
+    albumart_serial = albumart_loader->request(song.uri, key);
+}
+
+void
+PlayerScreen::upcoming_changed(QStringList uris, QStringList albums)
+{
+    QStringList keys;
+    int i;
+
+    for (i = 0; i < uris.size(); i++) {
+        keys.push_back(AlbumArtCache::key(uris[i], albums[i]));
+    }
+
+    /* Files are read ahead even if their art is already cached */
+    albumart_loader->prefetch(uris, keys);
+}
+
+void
+PlayerScreen::albumart_prefetched(QString key, QImage image, bool known)
+{
+    QPixmap pixmap;
+
+    if (!known || albumart_cache.find_memory(key, &pixmap)) {
+        return;
+    }
+
+    if (!image.isNull()) {
+        pixmap = QPixmap::fromImage(image);
+    }
+
+    albumart_cache.insert_memory(key, pixmap);
+}
+
+void
+PlayerScreen::albumart_loaded(int serial, QString key, QImage image, bool known)
+{
+    QPixmap pixmap;
+
+    if (!image.isNull()) {
+        pixmap = QPixmap::fromImage(image);
+    }
+
+    /* Unreadable files are asked for again on the next track change */
+    if (known) {
+        albumart_cache.insert_memory(key, pixmap);
+    }
+
+    if (serial != albumart_serial) {
         return;
     }
 
-    albumart = source.scaled(240, 240, Qt::KeepAspectRatioByExpanding, Qt::SmoothTransformation);
-    albumart_widget->setPixmap(albumart);
+    albumart = pixmap;
+    if (albumart.isNull()) {
+        albumart_widget->reset();
+    } else {
+        albumart_widget->setPixmap(albumart);
+    }
 }
@@ -5,10 +5,17 @@
 #include <QLabel>
 #include <QList>
 #include <QString>
+#include <QStringList>
 #include <QTabWidget>
+#include <QTimer>
+
+#include <memory>
 
 #include "mpdclient.hpp"
 #include "albumartwidget.hpp"
+#include "albumartcache.hpp"
+#include "albumartloader.hpp"
+#include "time.hpp"
 
 
 #ifndef _GUI_PLAYERSCREEN_H_
@@ -20,16 +27,35 @@ class PlayerScreen : public QTabWidget
     Q_OBJECT
 
 public:
-    PlayerScreen();
+    PlayerScreen(MPDClient * mpd_client_);
 
     AlbumArtWidget * albumart_widget;
 
 public slots:
-    void info_changed(MPDPlayerInfo * info);
-    void elapsed_changed(MPDPlayerInfo * info);
-    void uri_changed(MPDPlayerInfo * info);
+    /**
+     * Draw the parts of the latest player state snapshot given by
+     * `changed`, a combination of MPD_CHANGED_* flags.
+     */
+    void player_changed(unsigned changed);
+    void upcoming_changed(QStringList uris, QStringList albums);
+    void albumart_loaded(int serial, QString key, QImage image, bool known);
+    void albumart_prefetched(QString key, QImage image, bool known);
+
+private slots:
+    void draw_elapsed();
 
 private:
+    void draw_song(const MPDSongInfo & song);
+    void draw_albumart(const MPDSongInfo & song);
+
+    MPDClient * mpd_client;
+
+    /* Snapshot currently on screen, and the elapsed clock as shown */
+    std::shared_ptr<const MPDPlayerInfo> drawn;
+    qint64 shown_seconds;
+    qint64 shown_duration;
+    mpd_state shown_state;
+
     QVBoxLayout * layout;
     QHBoxLayout * info_layout;
     QVBoxLayout * song_layout;
@@ -42,7 +68,11 @@ private:
     QLabel * elapsed;
     QProgressBar * progress;
     QProgressBar * volume;
+    QTimer * elapsed_timer;
     QPixmap albumart;
+    AlbumArtCache albumart_cache;
+    AlbumArtLoader * albumart_loader;
+    int albumart_serial;
 };
 
 
@@ -0,0 +1,129 @@
+#include "queuemodel.hpp"
+
+
+QueueModel::QueueModel(QObject * parent) : QAbstractListModel(parent)
+{
+    fetch_timer = new QTimer(this);
+    fetch_timer->setSingleShot(true);
+    fetch_timer->setInterval(0);
+
+    QObject::connect(fetch_timer, &QTimer::timeout,
+                     this, &QueueModel::request_pages);
+}
+
+int
+QueueModel::rowCount(const QModelIndex & parent) const
+{
+    if (parent.isValid()) {
+        return 0;
+    }
+    return rows.size();
+}
+
+/*
+ * Rows that are not fetched yet are shown blank. Requests are deferred to
+ * the event loop, so that a whole repaint results in one request per page.
+ */
+QVariant
+QueueModel::data(const QModelIndex & index, int role) const
+{
+    if (role != Qt::DisplayRole || !index.isValid() || index.row() >= rows.size()) {
+        return QVariant();
+    }
+
+    if (rows[index.row()].isNull()) {
+        wanted.insert(index.row() / QUEUE_PAGE_SIZE);
+        fetch_timer->start();
+        return QString();
+    }
+
+    return rows[index.row()];
+}
+
+void
+QueueModel::request_pages()
+{
+    unsigned start;
+    unsigned end;
+
+    foreach (int page, wanted) {
+        if (requested.contains(page)) {
+            continue;
+        }
+        start = page * QUEUE_PAGE_SIZE;
+        end = qMin(start + QUEUE_PAGE_SIZE, (unsigned)rows.size());
+        if (start >= end) {
+            continue;
+        }
+        requested.insert(page);
+        emit page_requested(start, end);
+    }
+
+    wanted.clear();
+}
+
+void
+QueueModel::queue_changed(unsigned length, QVector<quint32> positions, bool reset)
+{
+    unsigned size;
+    int first = -1;
+    int last = -1;
+
+    if (reset) {
+        beginResetModel();
+        rows = QVector<QString>(length);
+        wanted.clear();
+        requested.clear();
+        endResetModel();
+        return;
+    }
+
+    size = rows.size();
+    if (length < size) {
+        beginRemoveRows(QModelIndex(), length, size - 1);
+        rows.resize(length);
+        endRemoveRows();
+    } else if (length > size) {
+        beginInsertRows(QModelIndex(), size, length - 1);
+        rows.resize(length);
+        endInsertRows();
+    }
+
+    foreach (quint32 pos, positions) {
+        if (pos >= length) {
+            continue;
+        }
+        rows[pos] = QString();
+        requested.remove(pos / QUEUE_PAGE_SIZE);
+        if (first == -1 || (int)pos < first) {
+            first = pos;
+        }
+        if ((int)pos > last) {
+            last = pos;
+        }
+    }
+
+    if (first != -1) {
+        emit dataChanged(index(first), index(last));
+    }
+}
+
+void
+QueueModel::queue_page(unsigned start, QStringList rows_)
+{
+    unsigned end;
+    unsigned i;
+
+    requested.remove(start / QUEUE_PAGE_SIZE);
+
+    end = qMin(start + rows_.size(), (unsigned)rows.size());
+    if (start >= end) {
+        return;
+    }
+
+    for (i = start; i < end; i++) {
+        rows[i] = rows_[i - start];
+    }
+
+    emit dataChanged(index(start), index(end - 1));
+}
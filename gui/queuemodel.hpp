@@ -0,0 +1,70 @@
+#include <QAbstractListModel>
+#include <QSet>
+#include <QStringList>
+#include <QTimer>
+#include <QVector>
+
+
+#ifndef _GUI_QUEUEMODEL_H_
+#define _GUI_QUEUEMODEL_H_
+
+
+/**
+ * Number of queue entries fetched from MPD per request.
+ */
+#define QUEUE_PAGE_SIZE 64
+
+
+/**
+ * List model of the MPD queue, loaded lazily.
+ *
+ * The model always has one row per queue entry, but the text of a row is
+ * only fetched once the view asks for it. Missing rows are collected
+ * while the view paints, and requested a page at a time afterwards.
+ *
+ * Changes to the queue are applied incrementally: only the entries MPD
+ * reports as changed are dropped, to be fetched again if they are shown.
+ */
+class QueueModel : public QAbstractListModel
+{
+    Q_OBJECT
+
+public:
+    QueueModel(QObject * parent = NULL);
+
+    int rowCount(const QModelIndex & parent = QModelIndex()) const;
+    QVariant data(const QModelIndex & index, int role = Qt::DisplayRole) const;
+
+signals:
+    /**
+     * Ask for the queue entries in the range [start, end).
+     */
+    void page_requested(unsigned start, unsigned end);
+
+public slots:
+    /**
+     * Resize the model and forget changed entries. If `reset` is set, all
+     * entries are forgotten.
+     */
+    void queue_changed(unsigned length, QVector<quint32> positions, bool reset);
+
+    /**
+     * Store fetched entries, starting at position `start`.
+     */
+    void queue_page(unsigned start, QStringList rows_);
+
+private slots:
+    void request_pages();
+
+private:
+    /* Text of each entry; null if not fetched */
+    QVector<QString> rows;
+
+    /* Pages the view asked for, and pages requested from MPD */
+    mutable QSet<int> wanted;
+    QSet<int> requested;
+    QTimer * fetch_timer;
+};
+
+
+#endif /* _GUI_QUEUEMODEL_H_ */
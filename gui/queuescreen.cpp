@@ -0,0 +1,25 @@
+#include <QScrollBar>
+
+#include "queuescreen.hpp"
+
+
+QueueScreen::QueueScreen()
+{
+    queue = new QueueModel(this);
+    setModel(queue);
+
+    setUniformItemSizes(true);
+    setEditTriggers(QAbstractItemView::NoEditTriggers);
+
+    verticalScrollBar()->setSingleStep(3);
+    setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+
+    QObject::connect(this, &QListView::clicked,
+                     this, &QueueScreen::row_clicked);
+}
+
+void
+QueueScreen::row_clicked(const QModelIndex & index)
+{
+    emit selected(index.row());
+}
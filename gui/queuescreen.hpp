@@ -0,0 +1,31 @@
+#include <QListView>
+#include <QModelIndex>
+
+#include "queuemodel.hpp"
+
+
+#ifndef _GUI_QUEUESCREEN_H_
+#define _GUI_QUEUESCREEN_H_
+
+
+/**
+ * Touch friendly view of the MPD queue. Tapping an entry plays it.
+ */
+class QueueScreen : public QListView
+{
+    Q_OBJECT
+
+public:
+    QueueScreen();
+
+    QueueModel * queue;
+
+signals:
+    void selected(int pos);
+
+private slots:
+    void row_clicked(const QModelIndex & index);
+};
+
+
+#endif /* _GUI_QUEUESCREEN_H_ */
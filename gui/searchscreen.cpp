@@ -32,12 +32,14 @@ SearchScreen::key_pressed()
     QPushButton * sender;
     sender = dynamic_cast<QPushButton *>(QObject::sender());
     term.setText(term.text() + sender->text());
+    emit term_changed(term.text());
 }
 
 void
 SearchScreen::backspace_pressed()
 {
     term.setText(term.text().left(term.text().length() - 1));
+    emit term_changed(term.text());
 }
 
 void
@@ -56,6 +58,7 @@ void
 SearchScreen::spacebar_pressed()
 {
     term.setText(term.text() + " ");
+    emit term_changed(term.text());
 }
 
 void
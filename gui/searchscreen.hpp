@@ -33,6 +33,11 @@ signals:
     void search(QString term);
     void cancel();
 
+    /**
+     * The term has been edited.
+     */
+    void term_changed(QString term);
+
 public slots:
 
     void key_pressed();
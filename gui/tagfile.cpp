@@ -1,25 +1,162 @@
 #include "tagfile.hpp"
 
+#include <QBuffer>
+#include <QByteArray>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QImageReader>
+
 #include <id3v2tag.h>
 #include <mpegfile.h>
 #include <id3v2frame.h>
 #include <id3v2header.h>
 #include <attachedpictureframe.h>
 
-#include <tlist.h>
 #include <flacfile.h>
-#include <flacpicture.h>
-#include <tbytevector.h>
+
+#include <mp4file.h>
+#include <mp4tag.h>
+#include <mp4item.h>
+#include <mp4coverart.h>
+
+#include <xiphcomment.h>
+#include <vorbisfile.h>
+#include <opusfile.h>
+#include <oggflacfile.h>
+
+
+/**
+ * How many bytes to read when detecting the container format.
+ */
+#define SNIFF_SIZE 128
+
+/**
+ * Cover images looked for next to the music file, in order of preference.
+ */
+static const char * sidecar_names[] = {
+    "cover.jpg",
+    "folder.jpg",
+    "front.jpg",
+    "Cover.jpg",
+    "Folder.jpg",
+    "cover.png",
+    "folder.png",
+    NULL
+};
+
+
+TagFile::TagFile(const QString & path_)
+{
+    path = path_;
+}
+
+TagFile::Container
+TagFile::sniff() const
+{
+    QFile file(path);
+    QByteArray head;
+    QByteArray packet;
+    qint64 id3_size;
+    int segments;
+
+    if (!file.open(QIODevice::ReadOnly)) {
+        return CONTAINER_UNKNOWN;
+    }
+
+    head = file.read(SNIFF_SIZE);
+
+    /* An ID3v2 tag may precede both MPEG and FLAC streams */
+    if (head.startsWith("ID3") && head.size() >= 10) {
+        id3_size = ((head[6] & 0x7f) << 21) | ((head[7] & 0x7f) << 14) |
+                   ((head[8] & 0x7f) << 7) | (head[9] & 0x7f);
+        id3_size += (head[5] & 0x10) ? 20 : 10;
+        if (file.seek(id3_size) && file.read(4) == "fLaC") {
+            return CONTAINER_FLAC;
+        }
+        return CONTAINER_MPEG;
+    }
+
+    if (head.startsWith("fLaC")) {
+        return CONTAINER_FLAC;
+    }
+
+    /* The first Ogg page holds the codec identification header */
+    if (head.startsWith("OggS") && head.size() > 27) {
+        segments = (unsigned char)head[26];
+        packet = head.mid(27 + segments);
+        if (packet.startsWith("OpusHead")) {
+            return CONTAINER_OGG_OPUS;
+        } else if (packet.mid(1).startsWith("vorbis")) {
+            return CONTAINER_OGG_VORBIS;
+        } else if (packet.startsWith("\x7f" "FLAC")) {
+            return CONTAINER_OGG_FLAC;
+        }
+        return CONTAINER_UNKNOWN;
+    }
+
+    if (head.mid(4, 4) == "ftyp") {
+        return CONTAINER_MP4;
+    }
+
+    /* MPEG audio frame sync */
+    if (head.size() >= 2 && (unsigned char)head[0] == 0xff && (head[1] & 0xe0) == 0xe0) {
+        return CONTAINER_MPEG;
+    }
+
+    return CONTAINER_UNKNOWN;
+}
+
+bool
+TagFile::decode_album_art(QIODevice * device, const QSize & size, QImage * image)
+{
+    QImageReader reader(device);
+    QSize source;
+    QSize scaled;
+
+    /* Let the image decoder scale down, instead of decoding at full size */
+    source = reader.size();
+    if (size.isValid() && source.isValid()) {
+        scaled = source.scaled(size, Qt::KeepAspectRatioByExpanding);
+        if (scaled.width() < source.width()) {
+            reader.setScaledSize(scaled);
+        }
+    }
+
+    return reader.read(image);
+}
+
+bool
+TagFile::pick_picture(const TagLib::List<TagLib::FLAC::Picture *> & list, TagLib::ByteVector * picture)
+{
+    TagLib::List<TagLib::FLAC::Picture *>::ConstIterator it;
+
+    /* Prefer the front cover, but settle for any picture */
+    for (it = list.begin(); it != list.end(); ++it) {
+        if ((*it)->type() == TagLib::FLAC::Picture::FrontCover && !(*it)->data().isEmpty()) {
+            *picture = (*it)->data();
+            return true;
+        }
+    }
+
+    for (it = list.begin(); it != list.end(); ++it) {
+        if (!(*it)->data().isEmpty()) {
+            *picture = (*it)->data();
+            return true;
+        }
+    }
+
+    return false;
+}
 
 bool
-TagFile::get_id3_album_art(QPixmap * image)
+TagFile::get_id3_picture(TagLib::ByteVector * picture)
 {
-    TagLib::MPEG::File file(path.toUtf8().data());
+    TagLib::MPEG::File file(path.toUtf8().data(), false);
     TagLib::ID3v2::Tag *tag;
     TagLib::ID3v2::FrameList frame;
     TagLib::ID3v2::AttachedPictureFrame *picture_frame;
     TagLib::ID3v2::FrameList::ConstIterator it;
-    unsigned long size;
 
     /* Open file and read tags */
     tag = file.ID3v2Tag();
@@ -34,71 +171,142 @@ TagFile::get_id3_album_art(QPixmap * image)
         return false;
     }
 
-    /* Discover front cover picture frame */
+    /* Discover front cover picture frame, or settle for any picture */
     for (it = frame.begin(); it != frame.end(); ++it) {
         picture_frame = (TagLib::ID3v2::AttachedPictureFrame *)(*it);
 
-        if (picture_frame->type() != TagLib::ID3v2::AttachedPictureFrame::FrontCover) {
+        if (picture_frame->picture().isEmpty()) {
             continue;
         }
 
-        size = picture_frame->picture().size();
-        if (!size) {
-            continue;
+        *picture = picture_frame->picture();
+        if (picture_frame->type() == TagLib::ID3v2::AttachedPictureFrame::FrontCover) {
+            return true;
         }
-
-        image->loadFromData((const unsigned char *)picture_frame->picture().data(), size);
-        return true;
     }
 
-    return false;
+    return !picture->isEmpty();
 }
 
 bool
-TagFile::get_flac_album_art(QPixmap * image)
+TagFile::get_flac_picture(TagLib::ByteVector * picture)
 {
-    TagLib::FLAC::File file(path.toUtf8().data());
-    const TagLib::List<TagLib::FLAC::Picture *> & list = file.pictureList();
-    TagLib::List<TagLib::FLAC::Picture *>::ConstIterator it;
-    TagLib::FLAC::Picture * picture;
-    unsigned long size;
+    TagLib::FLAC::File file(path.toUtf8().data(), false);
+
+    return pick_picture(file.pictureList(), picture);
+}
+
+bool
+TagFile::get_mp4_picture(TagLib::ByteVector * picture)
+{
+    TagLib::MP4::File file(path.toUtf8().data(), false);
+    TagLib::MP4::Tag * tag;
+    TagLib::MP4::CoverArtList list;
+    TagLib::MP4::CoverArtList::ConstIterator it;
 
-    if (!list.size()) {
+    tag = file.tag();
+    if (!tag || !tag->contains("covr")) {
         return false;
     }
 
+    list = tag->item("covr").toCoverArtList();
     for (it = list.begin(); it != list.end(); ++it) {
+        if (!it->data().isEmpty()) {
+            *picture = it->data();
+            return true;
+        }
+    }
 
-        picture = *it;
+    return false;
+}
 
-        if (picture->type() != TagLib::FLAC::Picture::FrontCover) {
-            continue;
-        }
+/*
+ * Ogg streams store pictures as METADATA_BLOCK_PICTURE entries in the
+ * Vorbis comment, which TagLib decodes into FLAC pictures.
+ */
+bool
+TagFile::get_xiph_picture(Container container, TagLib::ByteVector * picture)
+{
+    TagLib::Ogg::XiphComment * tag = NULL;
 
-        size = picture->data().size();
-        if (!size) {
-            continue;
+    switch (container) {
+        case CONTAINER_OGG_VORBIS: {
+            TagLib::Ogg::Vorbis::File file(path.toUtf8().data(), false);
+            tag = file.tag();
+            return tag && pick_picture(tag->pictureList(), picture);
         }
-
-        image->loadFromData((const unsigned char *)picture->data().data(), size);
-        return true;
+        case CONTAINER_OGG_OPUS: {
+            TagLib::Ogg::Opus::File file(path.toUtf8().data(), false);
+            tag = file.tag();
+            return tag && pick_picture(tag->pictureList(), picture);
+        }
+        case CONTAINER_OGG_FLAC: {
+            TagLib::Ogg::FLAC::File file(path.toUtf8().data(), false);
+            tag = file.tag();
+            return tag && pick_picture(tag->pictureList(), picture);
+        }
+        default:
+            return false;
     }
+}
 
-    return false;
+bool
+TagFile::get_embedded_picture(TagLib::ByteVector * picture)
+{
+    Container container;
+
+    container = sniff();
+
+    switch (container) {
+        case CONTAINER_MPEG:
+            return get_id3_picture(picture);
+        case CONTAINER_FLAC:
+            return get_flac_picture(picture);
+        case CONTAINER_MP4:
+            return get_mp4_picture(picture);
+        case CONTAINER_OGG_VORBIS:
+        case CONTAINER_OGG_OPUS:
+        case CONTAINER_OGG_FLAC:
+            return get_xiph_picture(container, picture);
+        default:
+            return false;
+    }
 }
 
 bool
-TagFile::get_album_art(QPixmap * image)
+TagFile::get_sidecar_album_art(QImage * image, const QSize & size)
 {
-    if (get_id3_album_art(image)) {
-        return true;
-    } else if (get_flac_album_art(image)) {
-        return true;
+    QDir dir = QFileInfo(path).dir();
+    const char ** name;
+
+    for (name = sidecar_names; *name; name++) {
+        QFile file(dir.filePath(*name));
+        if (!file.open(QIODevice::ReadOnly)) {
+            continue;
+        }
+        if (decode_album_art(&file, size, image)) {
+            return true;
+        }
     }
+
     return false;
 }
 
-TagFile::TagFile(const QString & path_)
+bool
+TagFile::get_album_art(QImage * image, const QSize & size)
 {
-    path = path_;
+    TagLib::ByteVector picture;
+    QByteArray bytes;
+    QBuffer buffer;
+
+    if (get_embedded_picture(&picture)) {
+        bytes = QByteArray::fromRawData(picture.data(), picture.size());
+        buffer.setBuffer(&bytes);
+        buffer.open(QIODevice::ReadOnly);
+        if (decode_album_art(&buffer, size, image)) {
+            return true;
+        }
+    }
+
+    return get_sidecar_album_art(image, size);
 }
@@ -1,5 +1,11 @@
 #include <QObject>
-#include <QPixmap>
+#include <QIODevice>
+#include <QImage>
+#include <QSize>
+
+#include <tbytevector.h>
+#include <tlist.h>
+#include <flacpicture.h>
 
 
 #ifndef _GUI_TAGFILE_H_
@@ -7,7 +13,13 @@
 
 
 /**
- * Represents a music file with ID3 or FLAC tags.
+ * Represents a music file with embedded tags.
+ *
+ * The container format is detected from the file's magic bytes, and the
+ * file is parsed once with the matching TagLib class, reading tags only.
+ * Supported containers are MPEG (ID3v2), FLAC, MP4, and Ogg Vorbis, Opus
+ * and FLAC. If no picture is embedded, a cover image next to the file is
+ * used instead.
  */
 class TagFile : public QObject
 {
@@ -16,11 +28,40 @@ class TagFile : public QObject
 public:
     TagFile(const QString & path_);
 
-    bool get_id3_album_art(QPixmap * image);
-    bool get_flac_album_art(QPixmap * image);
-    bool get_album_art(QPixmap * image);
+    enum Container {
+        CONTAINER_UNKNOWN,
+        CONTAINER_MPEG,
+        CONTAINER_FLAC,
+        CONTAINER_MP4,
+        CONTAINER_OGG_VORBIS,
+        CONTAINER_OGG_OPUS,
+        CONTAINER_OGG_FLAC
+    };
+
+    /**
+     * Detect the container format from the first bytes of the file.
+     */
+    Container sniff() const;
+
+    /**
+     * Extract and decode the front cover. If a size is given, the picture
+     * is decoded directly at the smallest size that covers it, keeping the
+     * aspect ratio; JPEG pictures are then downscaled while decoding and
+     * the full-size bitmap is never created.
+     */
+    bool get_album_art(QImage * image, const QSize & size = QSize());
 
 private:
+    bool get_embedded_picture(TagLib::ByteVector * picture);
+    bool get_id3_picture(TagLib::ByteVector * picture);
+    bool get_flac_picture(TagLib::ByteVector * picture);
+    bool get_mp4_picture(TagLib::ByteVector * picture);
+    bool get_xiph_picture(Container container, TagLib::ByteVector * picture);
+    bool get_sidecar_album_art(QImage * image, const QSize & size);
+
+    static bool pick_picture(const TagLib::List<TagLib::FLAC::Picture *> & list, TagLib::ByteVector * picture);
+    static bool decode_album_art(QIODevice * device, const QSize & size, QImage * image);
+
     QString path;
 };
 
@@ -1,49 +1,66 @@
+#include <QElapsedTimer>
+
+#include <stdio.h>
+
 #include "time.hpp"
 
 
-void
-Time::set_total_ms(unsigned long milliseconds)
+Time::Time(qint64 ms_)
 {
-    unsigned long hours;
-    unsigned long minutes;
-    unsigned long seconds;
-
-    hours = milliseconds / 3600000;
-    milliseconds -= (hours * 3600000);
+    ms = ms_;
+}
 
-    minutes = milliseconds / 60000;
-    milliseconds -= (minutes * 60000);
+Time
+Time::now()
+{
+    QElapsedTimer timer;
 
-    seconds = milliseconds / 1000;
-    milliseconds -= (seconds * 1000);
+    timer.start();
+    return Time(timer.msecsSinceReference());
+}
 
-    this->setHMS(hours, minutes, seconds, milliseconds);
+void
+Time::set_total_ms(qint64 milliseconds)
+{
+    ms = milliseconds;
 }
 
-unsigned long
-Time::get_total_ms()
+qint64
+Time::get_total_ms() const
 {
-    return (get_total_seconds() * 1000) + msec();
+    return ms;
 }
 
-unsigned long
-Time::get_total_seconds()
+qint64
+Time::get_total_seconds() const
 {
-    return (hour() * 3600) + (minute() * 60) + second();
+    return ms / 1000;
 }
 
-QString
-Time::get_short_string()
+void
+Time::increment_ms(qint64 milliseconds)
 {
-    if (hour() == 0) {
-        return toString("mm:ss");
-    }
-    return toString("HH:mm:ss");
+    ms += milliseconds;
 }
 
 void
-Time::increment_ms(unsigned long ms)
+Time::format(char * buf) const
 {
-    ms += get_total_ms();
-    set_total_ms(ms);
+    unsigned hours;
+    unsigned minutes;
+    unsigned seconds;
+
+    seconds = ms > 0 ? ms / 1000 : 0;
+
+    hours = (seconds / 3600) % 1000;
+    seconds %= 3600;
+
+    minutes = seconds / 60;
+    seconds -= minutes * 60;
+
+    if (hours == 0) {
+        snprintf(buf, TIME_STRING_SIZE, "%02u:%02u", minutes, seconds);
+    } else {
+        snprintf(buf, TIME_STRING_SIZE, "%u:%02u:%02u", hours, minutes, seconds);
+    }
 }
@@ -1,19 +1,47 @@
-#include <QObject>
-#include <QTime>
+#include <QtGlobal>
+
+#include <stddef.h>
 
 
 #ifndef _GUI_TIME_H_
 #define _GUI_TIME_H_
 
 
-class Time : public QTime
+/**
+ * Buffer size needed by Time::format(), including the terminating NUL.
+ */
+#define TIME_STRING_SIZE 16
+
+
+/**
+ * A duration or point in time, as an integer number of milliseconds.
+ *
+ * Points in time are read from the monotonic clock with now(), and are only
+ * meaningful relative to each other.
+ */
+class Time
 {
 public:
-    void set_total_ms(unsigned long seconds);
-    unsigned long get_total_ms();
-    unsigned long get_total_seconds();
-    QString get_short_string();
-    void increment_ms(unsigned long ms);
+    Time(qint64 ms_ = 0);
+
+    /**
+     * Returns the current reading of the monotonic clock.
+     */
+    static Time now();
+
+    void set_total_ms(qint64 milliseconds);
+    qint64 get_total_ms() const;
+    qint64 get_total_seconds() const;
+    void increment_ms(qint64 milliseconds);
+
+    /**
+     * Write the time as "mm:ss", or as "h:mm:ss" from one hour on, into a
+     * buffer of at least TIME_STRING_SIZE bytes. Does not allocate.
+     */
+    void format(char * buf) const;
+
+private:
+    qint64 ms;
 };
 
 
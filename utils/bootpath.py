@@ -0,0 +1,131 @@
+#!/usr/bin/env python2.7
+#
+# Reconstruct the boot critical path from the BOOTMARK lines logged by the
+# caracas programs, see daemons/bootmark.h. Times are read from the monotonic
+# clock, which starts when the kernel boots, i.e. at ignition.
+
+import re
+import sys
+import argparse
+import subprocess
+
+MARK_RE = re.compile(r'BOOTMARK (\S+) (\S+) (\d+)')
+
+# Marks that must have happened before a mark can happen. The critical path
+# to a mark goes through whichever of these happened last.
+DEPENDS = {
+    'proxy ready': ['proxy start'],
+    'sigd ready': ['sigd start'],
+    'backlightd ready': ['backlightd start'],
+    'cmpd ready': ['cmpd start'],
+    'card music': ['card start'],
+    'card ready': ['card music'],
+    'cmpd audio': ['card music', 'cmpd ready', 'proxy ready'],
+    'gui frame': ['gui start'],
+    'gui interactive': ['gui frame'],
+}
+
+# Milestones reported as time since ignition
+TARGETS = [
+    ('first audio', 'cmpd audio'),
+    ('first frame', 'gui frame'),
+    ('interactive', 'gui interactive'),
+]
+
+
+def read_lines(path):
+    if path is None:
+        return subprocess.check_output(['journalctl', '-b', '--no-pager', '-o', 'cat']).splitlines()
+    if path == '-':
+        return sys.stdin.readlines()
+    with open(path, 'r') as f:
+        return f.readlines()
+
+
+def parse_marks(lines):
+    """
+    Returns a dictionary of mark name to seconds since boot, for the last
+    boot in the log. A mark that is earlier than the same mark seen before
+    means that the system was rebooted. If a program was restarted during
+    the boot, its first marks are kept.
+    """
+    marks = {}
+    for line in lines:
+        match = MARK_RE.search(line)
+        if not match:
+            continue
+        name = '%s %s' % (match.group(1), match.group(2))
+        seconds = int(match.group(3)) / 1000000.0
+        if name in marks and seconds < marks[name]:
+            marks = {}
+        if name not in marks:
+            marks[name] = seconds
+    return marks
+
+
+def critical_path(marks, name):
+    """
+    Returns the chain of marks leading up to a mark, earliest first.
+    """
+    path = [name]
+    while True:
+        prerequisites = [dep for dep in DEPENDS.get(path[0], []) if dep in marks]
+        if not prerequisites:
+            return path
+        path.insert(0, max(prerequisites, key=lambda dep: marks[dep]))
+
+
+def report(marks):
+    programs = sorted(set(name.split(' ')[0] for name in marks))
+
+    for title, name in TARGETS:
+        if name in marks:
+            print('ignition -> %-12s %8.3f s' % (title, marks[name]))
+        else:
+            print('ignition -> %-12s %8s' % (title, 'missing'))
+
+    print('')
+    print('%-12s %8s %8s %8s' % ('program', 'start', 'ready', 'duration'))
+    for program in programs:
+        start = marks.get(program + ' start')
+        ready = marks.get(program + ' ready', marks.get(program + ' frame'))
+        columns = [program]
+        columns.append('%8.3f' % start if start is not None else '%8s' % '-')
+        columns.append('%8.3f' % ready if ready is not None else '%8s' % '-')
+        if start is not None and ready is not None:
+            columns.append('%8.3f' % (ready - start))
+        else:
+            columns.append('%8s' % '-')
+        print('%-12s %s %s %s' % tuple(columns))
+
+    for title, name in TARGETS:
+        if name not in marks:
+            continue
+        print('')
+        print('critical path to %s:' % title)
+        previous = 0.0
+        print('%8.3f %8s  ignition' % (0.0, ''))
+        for step in critical_path(marks, name):
+            print('%8.3f %+8.3f  %s' % (marks[step], marks[step] - previous, step))
+            previous = marks[step]
+
+
+def main():
+    description = """
+    Report time from ignition to first audio and first frame, the startup
+    time of each program, and the chain of events each milestone waited for.
+    """
+    parser = argparse.ArgumentParser(description=description)
+    parser.add_argument('log', nargs='?', default=None, help='Log file to read, or - for stdin. Defaults to the journal of the current boot.')
+    args = parser.parse_args()
+
+    marks = parse_marks(read_lines(args.log))
+    if not marks:
+        sys.stderr.write('No boot marks found.\n')
+        sys.exit(1)
+
+    report(marks)
+
+
+if __name__ == '__main__':
+    main()